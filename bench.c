@@ -0,0 +1,292 @@
+/*
+ * Event pipeline benchmarks
+ *
+ * Microbenchmarks of the per-event hot paths, each printed as one JSON
+ * object per line so results can be collected and compared over time:
+ *   {"bench":"<name>","iterations":N,"ns_per_op":X,"ops_per_sec":Y}
+ *
+ * "bench -t <trace> <reports>" instead writes a synthetic trace for the
+ * end-to-end replay benchmark run by "make bench".
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xwiimote.h"
+#include "mouse.h"
+#include "filter.h"
+#include "gyro.h"
+#include "mpcal.h"
+#include "fusion.h"
+#include "trace.h"
+#include "curve.h"
+
+#define BENCH_OUTPUT_ITERATIONS 200000
+#define BENCH_CURVE_ITERATIONS 4000000
+#define BENCH_MP_ITERATIONS 2000000
+
+/* report period of a remote, 100 Hz */
+#define BENCH_REPORT_DT 0.01
+
+/* keeps results alive so the compiler cannot drop the work */
+static volatile double bench_sink;
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *name, unsigned long iterations,
+                         double seconds)
+{
+  printf("{\"bench\":\"%s\",\"iterations\":%lu,\"ns_per_op\":%.2f,"
+         "\"ops_per_sec\":%.0f}\n", name, iterations,
+         seconds * 1e9 / iterations, iterations / seconds);
+}
+
+/* one relative motion frame written out, as wiimote_flush() does */
+static void bench_frame(int fd)
+{
+  struct mouse_frame frame;
+  unsigned long i;
+  double start;
+
+  mouse_frame_init(&frame, fd);
+  start = bench_now();
+  for (i = 0; i < BENCH_OUTPUT_ITERATIONS; i++) {
+    mouse_frame_rel(&frame, 1, -1);
+    mouse_frame_flush(&frame);
+  }
+  bench_report("frame_rel_flush", i, bench_now() - start);
+}
+
+static void bench_move_relative(int fd)
+{
+  unsigned long i;
+  double start;
+
+  start = bench_now();
+  for (i = 0; i < BENCH_OUTPUT_ITERATIONS; i++)
+    mouse_move_relative(fd, 1, -1);
+  bench_report("move_relative", i, bench_now() - start);
+}
+
+/* motion with an adaptive ballistics table, into a frame never written */
+static void bench_motion_accel(void)
+{
+  struct mouse_accel_params params;
+  static struct mouse_accel accel;
+  struct mouse_motion motion = { 0 };
+  struct mouse_frame frame;
+  unsigned long i;
+  double start;
+
+  mouse_accel_parse(&params, "adaptive:4");
+  mouse_accel_build(&accel, &params);
+  motion.accel = &accel;
+  mouse_frame_init(&frame, -1);
+  start = bench_now();
+  for (i = 0; i < BENCH_CURVE_ITERATIONS; i++) {
+    mouse_motion_add(&motion, (i & 15) * 0.7f, -0.3f);
+    mouse_motion_flush(&motion, &frame);
+    frame.num = 0;
+  }
+  bench_report("motion_accel", i, bench_now() - start);
+  bench_sink = motion.rx + motion.ry;
+}
+
+/* the response curve of accel_show_ext() and nunchuk_show_ext() */
+static double curve_pow(int32_t raw, double scale)
+{
+  double val = raw / 512.0;
+
+  if (val >= 0)
+    return scale * pow(val, 0.25);
+  return -scale * pow(-val, 0.25);
+}
+
+static void bench_curve(void)
+{
+  unsigned long i;
+  double start, sum = 0;
+
+  start = bench_now();
+  for (i = 0; i < BENCH_CURVE_ITERATIONS; i++)
+    sum += curve_pow((int32_t)(i & 1023) - 512, 10);
+  bench_report("curve_pow", i, bench_now() - start);
+  bench_sink = sum;
+}
+
+/* the same curve compiled into a table, as wiiremote uses it */
+static void bench_curve_lut(void)
+{
+  const struct curve_params params = {
+    .type = CURVE_POWER, .range = 512, .scale = 10, .exponent = 0.25f,
+  };
+  static struct curve curve;
+  unsigned long i;
+  double start, sum = 0;
+
+  curve_build(&curve, &params, -512, 512, 0, false);
+  start = bench_now();
+  for (i = 0; i < BENCH_CURVE_ITERATIONS; i++)
+    sum += curve_apply(&curve, (int32_t)(i & 1023) - 512);
+  bench_report("curve_lut", i, bench_now() - start);
+  bench_sink = sum;
+
+  curve_build(&curve, &params, -512, 512, 3, true);
+  start = bench_now();
+  for (i = 0; i < BENCH_CURVE_ITERATIONS; i++)
+    sum += curve_apply(&curve, (int32_t)(i & 1023) - 512);
+  bench_report("curve_lut_interp", i, bench_now() - start);
+  bench_sink = sum;
+}
+
+/* a slow circle with some noise, like the fake remotes */
+static void bench_sample(unsigned long n, struct xwii_event_abs *accel,
+                         struct xwii_event_abs *rate)
+{
+  float phase = 2.0f * (float)M_PI * (n % 200) / 200;
+
+  accel->x = (int32_t)(30 * sinf(phase));
+  accel->y = (int32_t)(30 * cosf(phase));
+  accel->z = 100;
+  rate->x = (int32_t)(3000 * cosf(phase)) + 40 + (int32_t)(n * 7 % 16) - 8;
+  rate->y = 20 + (int32_t)(n * 5 % 16) - 8;
+  rate->z = (int32_t)(3000 * sinf(phase)) - 25 + (int32_t)(n * 3 % 16) - 8;
+}
+
+/* everything mp_show() does per MotionPlus report in gyro mode */
+static void bench_mp(void)
+{
+  const struct filter_params params = {
+    .type = FILTER_ONE_EURO,
+    .min_cutoff = 3.0f, .beta = 0.0005f, .d_cutoff = 1.0f,
+  };
+  const struct gyro_params gyro_params = {
+    .dead_zone = 60.0f, .knee = 2000.0f, .speed = 1500.0f, .exponent = 1.5f,
+  };
+  struct xwii_event_abs accel, rate[100];
+  struct filter_axis axis[2];
+  struct gyro_mouse gyro;
+  struct mouse_motion motion = { 0, 0 };
+  struct mp_calib cal;
+  struct fusion fu;
+  unsigned long i;
+  float rx, ry, dx, dy;
+  double start, t = 0;
+
+  mp_calib_init(&cal);
+  fusion_init(&fu);
+  gyro_mouse_init(&gyro);
+  filter_reset(&axis[0]);
+  filter_reset(&axis[1]);
+  for (i = 0; i < 100; i++)
+    bench_sample(i, &accel, &rate[i]);
+  fusion_accel(&fu, &accel, t);
+
+  start = bench_now();
+  for (i = 0; i < BENCH_MP_ITERATIONS; i++) {
+    t += BENCH_REPORT_DT;
+    mp_calib_sample(&cal, &rate[i % 100]);
+    fusion_gyro(&fu, &rate[i % 100], t);
+    rx = filter_apply(&params, &axis[0], rate[i % 100].x, t);
+    ry = filter_apply(&params, &axis[1], rate[i % 100].z, t);
+    gyro_mouse_update(&gyro_params, &gyro, rx, ry, t, &dx, &dy);
+    mouse_motion_add(&motion, dx, dy);
+  }
+  bench_report("mp_integration", i, bench_now() - start);
+  bench_sink = motion.x + motion.y + fu.q[0];
+}
+
+/* reports of accel, IR and MotionPlus at 100 Hz, A toggled now and then */
+static int bench_trace(const char *path, unsigned long reports)
+{
+  struct trace_writer writer;
+  struct xwii_event ev;
+  struct xwii_event_abs accel, rate;
+  unsigned long n;
+  double t;
+  int ret, i;
+
+  unlink(path);
+  ret = trace_create(&writer, path);
+  if (ret)
+    return ret;
+
+  for (n = 0; n < reports && !ret; n++) {
+    t = 1000000.0 + n * BENCH_REPORT_DT;
+    bench_sample(n, &accel, &rate);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.time.tv_sec = (time_t)t;
+    ev.time.tv_usec = (suseconds_t)((t - (time_t)t) * 1e6);
+
+    if (n % 150 == 0 || n % 150 == 75) {
+      ev.type = XWII_EVENT_KEY;
+      ev.v.key.code = XWII_KEY_A;
+      ev.v.key.state = n % 150 == 0;
+      ret = trace_write(&writer, 0, &ev);
+    }
+
+    memset(&ev.v, 0, sizeof(ev.v));
+    ev.type = XWII_EVENT_ACCEL;
+    ev.v.abs[0] = accel;
+    ret = ret ? ret : trace_write(&writer, 0, &ev);
+
+    ev.type = XWII_EVENT_IR;
+    ev.v.abs[0].x = 412 + accel.x * 6;
+    ev.v.abs[0].y = 384 + accel.y * 5;
+    ev.v.abs[1].x = ev.v.abs[0].x + 200;
+    ev.v.abs[1].y = ev.v.abs[0].y;
+    for (i = 2; i < 4; i++)
+      ev.v.abs[i].x = ev.v.abs[i].y = 1023;
+    ret = ret ? ret : trace_write(&writer, 0, &ev);
+
+    memset(&ev.v, 0, sizeof(ev.v));
+    ev.type = XWII_EVENT_MOTION_PLUS;
+    ev.v.abs[0] = rate;
+    ret = ret ? ret : trace_write(&writer, 0, &ev);
+  }
+
+  if (trace_close(&writer) && !ret)
+    ret = -EIO;
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  int fd, ret;
+
+  if (argc == 4 && !strcmp(argv[1], "-t")) {
+    ret = bench_trace(argv[2], strtoul(argv[3], NULL, 0));
+    if (ret)
+      fprintf(stderr, "Cannot write trace %s: %s\n", argv[2], strerror(-ret));
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  /* the write() cost without a uinput device behind it */
+  fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror("Cannot open /dev/null");
+    return EXIT_FAILURE;
+  }
+
+  bench_frame(fd);
+  bench_move_relative(fd);
+  bench_motion_accel();
+  bench_curve();
+  bench_curve_lut();
+  bench_mp();
+
+  close(fd);
+  return EXIT_SUCCESS;
+}
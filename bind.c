@@ -0,0 +1,273 @@
+/*
+ * Key bindings
+ *
+ * A binding maps a remote key to an action in some modes. Bindings are
+ * compiled into one action per mode and remote key, so dispatching a key
+ * is a table lookup. The config file syntax is described in config.c.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "bind.h"
+
+struct bind_name {
+  const char *name;
+  unsigned int code;
+};
+
+static const struct bind_name remote_keys[] = {
+  { "left", XWII_KEY_LEFT }, { "right", XWII_KEY_RIGHT },
+  { "up", XWII_KEY_UP }, { "down", XWII_KEY_DOWN },
+  { "a", XWII_KEY_A }, { "b", XWII_KEY_B },
+  { "plus", XWII_KEY_PLUS }, { "minus", XWII_KEY_MINUS },
+  { "home", XWII_KEY_HOME }, { "one", XWII_KEY_ONE }, { "two", XWII_KEY_TWO },
+  { "x", XWII_KEY_X }, { "y", XWII_KEY_Y },
+  { "tl", XWII_KEY_TL }, { "tr", XWII_KEY_TR },
+  { "zl", XWII_KEY_ZL }, { "zr", XWII_KEY_ZR },
+  { "thumbl", XWII_KEY_THUMBL }, { "thumbr", XWII_KEY_THUMBR },
+  { "c", XWII_KEY_C }, { "z", XWII_KEY_Z },
+  { NULL, 0 },
+};
+
+static const struct bind_name buttons[] = {
+  { "left", BTN_LEFT }, { "right", BTN_RIGHT }, { "middle", BTN_MIDDLE },
+  { "side", BTN_SIDE }, { "extra", BTN_EXTRA },
+  { NULL, 0 },
+};
+
+static const struct bind_name pad_buttons[] = {
+  { "south", BTN_SOUTH }, { "east", BTN_EAST }, { "north", BTN_NORTH },
+  { "west", BTN_WEST }, { "tl", BTN_TL }, { "tr", BTN_TR },
+  { "tl2", BTN_TL2 }, { "tr2", BTN_TR2 }, { "select", BTN_SELECT },
+  { "start", BTN_START }, { "mode", BTN_MODE }, { "thumbl", BTN_THUMBL },
+  { "thumbr", BTN_THUMBR },
+  { NULL, 0 },
+};
+
+static const struct bind_name pedals[] = {
+  { "gas", ABS_RZ }, { "brake", ABS_Z },
+  { NULL, 0 },
+};
+
+/* keyboard keys by their KEY_* name in lower case, others by number */
+static const struct bind_name output_keys[] = {
+  { "a", KEY_A }, { "b", KEY_B }, { "c", KEY_C }, { "d", KEY_D },
+  { "e", KEY_E }, { "f", KEY_F }, { "g", KEY_G }, { "h", KEY_H },
+  { "i", KEY_I }, { "j", KEY_J }, { "k", KEY_K }, { "l", KEY_L },
+  { "m", KEY_M }, { "n", KEY_N }, { "o", KEY_O }, { "p", KEY_P },
+  { "q", KEY_Q }, { "r", KEY_R }, { "s", KEY_S }, { "t", KEY_T },
+  { "u", KEY_U }, { "v", KEY_V }, { "w", KEY_W }, { "x", KEY_X },
+  { "y", KEY_Y }, { "z", KEY_Z },
+  { "1", KEY_1 }, { "2", KEY_2 }, { "3", KEY_3 }, { "4", KEY_4 },
+  { "5", KEY_5 }, { "6", KEY_6 }, { "7", KEY_7 }, { "8", KEY_8 },
+  { "9", KEY_9 }, { "0", KEY_0 },
+  { "f1", KEY_F1 }, { "f2", KEY_F2 }, { "f3", KEY_F3 }, { "f4", KEY_F4 },
+  { "f5", KEY_F5 }, { "f6", KEY_F6 }, { "f7", KEY_F7 }, { "f8", KEY_F8 },
+  { "f9", KEY_F9 }, { "f10", KEY_F10 }, { "f11", KEY_F11 },
+  { "f12", KEY_F12 },
+  { "esc", KEY_ESC }, { "enter", KEY_ENTER }, { "space", KEY_SPACE },
+  { "tab", KEY_TAB }, { "backspace", KEY_BACKSPACE },
+  { "delete", KEY_DELETE }, { "insert", KEY_INSERT },
+  { "up", KEY_UP }, { "down", KEY_DOWN }, { "left", KEY_LEFT },
+  { "right", KEY_RIGHT }, { "home", KEY_HOME }, { "end", KEY_END },
+  { "pageup", KEY_PAGEUP }, { "pagedown", KEY_PAGEDOWN },
+  { "leftctrl", KEY_LEFTCTRL }, { "leftshift", KEY_LEFTSHIFT },
+  { "leftalt", KEY_LEFTALT }, { "leftmeta", KEY_LEFTMETA },
+  { "rightctrl", KEY_RIGHTCTRL }, { "rightshift", KEY_RIGHTSHIFT },
+  { "rightalt", KEY_RIGHTALT }, { "rightmeta", KEY_RIGHTMETA },
+  { "minus", KEY_MINUS }, { "equal", KEY_EQUAL }, { "comma", KEY_COMMA },
+  { "dot", KEY_DOT }, { "slash", KEY_SLASH },
+  { "volumeup", KEY_VOLUMEUP }, { "volumedown", KEY_VOLUMEDOWN },
+  { "mute", KEY_MUTE }, { "playpause", KEY_PLAYPAUSE },
+  { "nextsong", KEY_NEXTSONG }, { "previoussong", KEY_PREVIOUSSONG },
+  { "back", KEY_BACK }, { "forward", KEY_FORWARD },
+  { NULL, 0 },
+};
+
+static int name_lookup(const struct bind_name *names, const char *name)
+{
+  for (; names->name; names++)
+    if (!strcmp(names->name, name))
+      return names->code;
+  return -1;
+}
+
+static int output_key(const char *name)
+{
+  char *end;
+  long code;
+
+  code = name_lookup(output_keys, name);
+  if (code >= 0)
+    return code;
+  code = strtol(name, &end, 0);
+  if (*end || end == name || code <= 0 || code > KEY_MAX)
+    return -1;
+  return code;
+}
+
+/* add an EV_KEY code the pointer must be able to send */
+int bind_code(struct bind_table *table, int code)
+{
+  unsigned int i;
+
+  for (i = 0; table->codes[i] >= 0; i++)
+    if (table->codes[i] == code)
+      return 0;
+  if (i >= BIND_CODES_MAX)
+    return -ENOSPC;
+  table->codes[i] = code;
+  table->codes[i + 1] = -1;
+  return 0;
+}
+
+/* "k1+k2 k3": chords of keys, each step a key code, 0 ends a chord */
+static int parse_macro(struct bind_table *table, struct bind_macro *macro,
+                       char *args)
+{
+  char *chord, *key, *save_chord, *save_key;
+  int code;
+
+  macro->num = 0;
+  for (chord = strtok_r(args, " \t", &save_chord); chord;
+       chord = strtok_r(NULL, " \t", &save_chord)) {
+    for (key = strtok_r(chord, "+", &save_key); key;
+         key = strtok_r(NULL, "+", &save_key)) {
+      code = output_key(key);
+      if (code < 0 || macro->num >= BIND_MACRO_STEPS - 1)
+        return -EINVAL;
+      if (bind_code(table, code))
+        return -ENOSPC;
+      macro->steps[macro->num++] = code;
+    }
+    macro->steps[macro->num++] = 0;
+  }
+  return macro->num ? 0 : -EINVAL;
+}
+
+static int parse_action(struct bind_table *table, struct bind_action *action,
+                        char *args, const char *const *modes,
+                        unsigned int num_modes)
+{
+  char *type, *arg, *end;
+  long val;
+  int code;
+
+  type = strtok_r(args, " \t", &args);
+  if (!type)
+    return -EINVAL;
+  while (*args == ' ' || *args == '\t')
+    args++;
+
+  memset(action, 0, sizeof(*action));
+  if (!strcmp(type, "none"))
+    return *args ? -EINVAL : 0;
+  if (!strcmp(type, "clutch")) {
+    action->type = BIND_CLUTCH;
+    return *args ? -EINVAL : 0;
+  }
+  if (!strcmp(type, "macro")) {
+    if (table->num_macros >= BIND_MACRO_MAX)
+      return -ENOSPC;
+    if (parse_macro(table, &table->macros[table->num_macros], args))
+      return -EINVAL;
+    action->type = BIND_MACRO;
+    action->value = table->num_macros++;
+    return 0;
+  }
+
+  /* the other actions take exactly one argument */
+  arg = strtok_r(args, " \t", &args);
+  if (!arg || strtok_r(NULL, " \t", &args))
+    return -EINVAL;
+
+  if (!strcmp(type, "button") || !strcmp(type, "key")) {
+    code = type[0] == 'b' ? name_lookup(buttons, arg) : output_key(arg);
+    if (code < 0)
+      return -EINVAL;
+    action->type = BIND_KEY;
+    action->code = code;
+    return bind_code(table, code);
+  }
+  if (!strcmp(type, "pad") || !strcmp(type, "pedal")) {
+    code = name_lookup(type[1] == 'a' ? pad_buttons : pedals, arg);
+    if (code < 0)
+      return -EINVAL;
+    action->type = type[1] == 'a' ? BIND_PAD : BIND_PEDAL;
+    action->code = code;
+    return 0;
+  }
+  if (!strcmp(type, "wheel") || !strcmp(type, "hwheel")) {
+    val = strtol(arg, &end, 0);
+    if (*end || end == arg || !val || val < -100 || val > 100)
+      return -EINVAL;
+    action->type = BIND_WHEEL;
+    action->code = type[0] == 'w' ? REL_WHEEL : REL_HWHEEL;
+    action->value = val;
+    return 0;
+  }
+  if (!strcmp(type, "mode")) {
+    for (code = 0; code < (int)num_modes; code++)
+      if (modes[code] && !strcmp(modes[code], arg))
+        break;
+    if (code == (int)num_modes)
+      return -EINVAL;
+    action->type = BIND_MODE;
+    action->value = code;
+    return 0;
+  }
+  return -EINVAL;
+}
+
+/* "mode mode ..." into a mask of modes */
+int bind_modes(char *names, const char *const *modes, unsigned int num_modes,
+               unsigned int *mask)
+{
+  char *name, *save;
+  unsigned int m;
+
+  *mask = 0;
+  for (name = strtok_r(names, " \t,", &save); name;
+       name = strtok_r(NULL, " \t,", &save)) {
+    for (m = 0; m < num_modes; m++)
+      if (modes[m] && !strcmp(modes[m], name))
+        break;
+    if (m == num_modes)
+      return -EINVAL;
+    *mask |= 1u << m;
+  }
+  return *mask ? 0 : -EINVAL;
+}
+
+/* XWII_KEY_* code of a remote key name, -1 if there is none */
+int bind_key(const char *name)
+{
+  return name_lookup(remote_keys, name);
+}
+
+/* bind a remote key to the action described by args in the modes of mask */
+int bind_set(struct bind_table *table, unsigned int mask, unsigned int key,
+             char *args, const char *const *modes, unsigned int num_modes)
+{
+  struct bind_action action;
+  unsigned int m;
+  int ret;
+
+  if (key >= XWII_KEY_NUM || num_modes > BIND_MODES_MAX)
+    return -EINVAL;
+  ret = parse_action(table, &action, args, modes, num_modes);
+  if (ret)
+    return ret;
+  for (m = 0; m < num_modes; m++)
+    if (mask & (1u << m))
+      table->keys[m][key] = action;
+  return 0;
+}
+
+void bind_init(struct bind_table *table)
+{
+  memset(table, 0, sizeof(*table));
+  table->codes[0] = -1;
+}
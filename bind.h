@@ -0,0 +1,66 @@
+#ifndef __WII_BIND_H__
+#define __WII_BIND_H__ 1
+
+#include <stdint.h>
+
+#include "xwiimote.h"
+
+/* modes a table holds, the caller's mode count must not exceed it */
+#define BIND_MODES_MAX 8
+/* macros per table and key codes per macro, chord separators included */
+#define BIND_MACRO_MAX 32
+#define BIND_MACRO_STEPS 16
+/* distinct EV_KEY codes a table may send */
+#define BIND_CODES_MAX 64
+
+enum bind_type {
+  BIND_NONE,
+  /* EV_KEY code, held as long as the remote key is held */
+  BIND_KEY,
+  /* REL_WHEEL or REL_HWHEEL code, value detents per press */
+  BIND_WHEEL,
+  /* value indexes the macros, tapped once per press */
+  BIND_MACRO,
+  /* value is the mode switched to on press */
+  BIND_MODE,
+  /* air mouse clutch: the pointer stands still while held */
+  BIND_CLUTCH,
+  /* EV_KEY code on the gamepad, held as long as the remote key is held */
+  BIND_PAD,
+  /* gamepad trigger axis code, fully pressed while the key is held */
+  BIND_PEDAL,
+};
+
+struct bind_action {
+  uint8_t type;
+  uint16_t code;
+  int16_t value;
+};
+
+/* chords tapped in order, each chord ends with a 0 step */
+struct bind_macro {
+  unsigned int num;
+  uint16_t steps[BIND_MACRO_STEPS];
+};
+
+/*
+ * Key bindings compiled into flat arrays, so a key event is one lookup by
+ * mode and XWII_KEY_* code.
+ */
+struct bind_table {
+  struct bind_action keys[BIND_MODES_MAX][XWII_KEY_NUM];
+  struct bind_macro macros[BIND_MACRO_MAX];
+  unsigned int num_macros;
+  /* every EV_KEY code used, -1 terminated, for the uinput capabilities */
+  int codes[BIND_CODES_MAX + 1];
+};
+
+void bind_init(struct bind_table *table);
+int bind_modes(char *names, const char *const *modes, unsigned int num_modes,
+               unsigned int *mask);
+int bind_key(const char *name);
+int bind_code(struct bind_table *table, int code);
+int bind_set(struct bind_table *table, unsigned int mask, unsigned int key,
+             char *args, const char *const *modes, unsigned int num_modes);
+
+#endif /* __WII_BIND_H__ */
@@ -0,0 +1,565 @@
+/*
+ * Config file and hot reload
+ *
+ * The config holds key bindings and per-mode tuning:
+ *
+ *   # comment
+ *   gyro_speed = 2000
+ *   [normal ir gyro]
+ *   up = wheel 1
+ *   a = button left
+ *   plus = key volumeup
+ *   home = macro leftctrl+c space
+ *   one = mode gyro
+ *   [gyro]
+ *   b = clutch
+ *   pointer_accel = adaptive:3
+ *   filter = kalman
+ *   [nfs]
+ *   steer_range = 45
+ *   steer_curve = power:1.5
+ *   [normal]
+ *   nunchuk = scroll
+ *   c = button right
+ *
+ * A section lists the modes its lines apply to; lines before the first
+ * section apply to all modes. A line sets a remote key binding or an
+ * option; later lines override earlier ones. Options other than per-mode
+ * ones apply whatever the section.
+ *
+ * The file's directory is watched with inotify from the main poll set. A
+ * change only wakes the reload thread, which parses the file into the
+ * spare of two buffers and publishes it with one atomic pointer store.
+ * The main thread picks the pointer up at every wakeup and drops it before
+ * it polls again. The spare is reused only after the main thread went
+ * through such a quiescent state, so a reload never blocks input and never
+ * changes a config in use.
+ */
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "config.h"
+#include "log.h"
+
+#define CONFIG_LINE_MAX 256
+/* how often a reload checks whether the old config is still in use */
+#define CONFIG_GRACE_NS 1000000L
+
+/* float options, by offset into struct filter_params or gyro_params */
+struct config_float {
+  const char *name;
+  size_t offset;
+  /* 0 is not a valid value */
+  bool positive;
+};
+
+static const struct config_float filter_options[] = {
+  { "filter_min_cutoff", offsetof(struct filter_params, min_cutoff), true },
+  { "filter_beta", offsetof(struct filter_params, beta), false },
+  { "filter_d_cutoff", offsetof(struct filter_params, d_cutoff), true },
+  { "filter_process_noise", offsetof(struct filter_params, process_noise), true },
+  { "filter_measure_noise", offsetof(struct filter_params, measure_noise), true },
+  { NULL, 0, false },
+};
+
+static const struct config_float stick_options[] = {
+  { "stick_dead_zone_x", offsetof(struct config, stick_dead_zone[0]), false },
+  { "stick_dead_zone_y", offsetof(struct config, stick_dead_zone[1]), false },
+  { "stick_speed", offsetof(struct config, stick_speed), true },
+  { "scroll_speed", offsetof(struct config, scroll_speed), true },
+  { "wasd_threshold", offsetof(struct config, wasd_threshold), true },
+  { NULL, 0, false },
+};
+
+static const char *const stick_names[] = {
+  [CONFIG_STICK_OFF] = "off",
+  [CONFIG_STICK_POINTER] = "pointer",
+  [CONFIG_STICK_SCROLL] = "scroll",
+  [CONFIG_STICK_WASD] = "wasd",
+  NULL,
+};
+
+static const struct config_float gyro_options[] = {
+  { "gyro_dead_zone", offsetof(struct gyro_params, dead_zone), false },
+  { "gyro_knee", offsetof(struct gyro_params, knee), true },
+  { "gyro_speed", offsetof(struct gyro_params, speed), true },
+  { "gyro_exponent", offsetof(struct gyro_params, exponent), true },
+  { NULL, 0, false },
+};
+
+/* the config file and what a reload starts from */
+static const char *config_path;
+static char config_dir[PATH_MAX], config_name[NAME_MAX + 1];
+static struct config config_base;
+static const char *const *config_modes;
+static unsigned int config_num_modes;
+/* EV_KEY codes the virtual devices were created with */
+static int config_codes[BIND_CODES_MAX + 1];
+
+static struct config config_buf[2];
+static struct config *_Atomic config_live;
+/* bumped by config_enter() and config_leave(), odd while a config is held */
+static _Atomic uint64_t config_reader;
+
+static int config_inotify = -1;
+static pthread_t config_thread;
+static bool config_running;
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t config_cond = PTHREAD_COND_INITIALIZER;
+static bool config_pending;
+static atomic_bool config_stopping;
+
+static char *trim(char *str)
+{
+  char *end;
+
+  while (*str == ' ' || *str == '\t')
+    str++;
+  end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+                       end[-1] == '\n' || end[-1] == '\r'))
+    *--end = 0;
+  return str;
+}
+
+static int parse_float(const char *value, bool positive, float *out)
+{
+  char *end;
+  float val = strtof(value, &end);
+
+  if (*end || end == value || !(val >= 0) || (positive && val == 0))
+    return -EINVAL;
+  *out = val;
+  return 0;
+}
+
+static const struct config_float *find_float(const struct config_float *opts,
+                                             const char *name)
+{
+  for (; opts->name; opts++)
+    if (!strcmp(opts->name, name))
+      return opts;
+  return NULL;
+}
+
+static int config_option(struct config *config, unsigned int mask,
+                         unsigned int num_modes, const char *name,
+                         const char *value)
+{
+  const struct config_float *opt;
+  struct mouse_accel_params accel;
+  unsigned int m, stick;
+  float val;
+  int filter;
+
+  opt = find_float(gyro_options, name);
+  if (opt) {
+    if (parse_float(value, opt->positive, &val))
+      return -EINVAL;
+    *(float *)((char *)&config->gyro + opt->offset) = val;
+    return 0;
+  }
+
+  opt = find_float(filter_options, name);
+  if (opt) {
+    if (parse_float(value, opt->positive, &val))
+      return -EINVAL;
+    for (m = 0; m < num_modes; m++)
+      if (mask & (1u << m))
+        *(float *)((char *)&config->filter[m] + opt->offset) = val;
+    return 0;
+  }
+
+  opt = find_float(stick_options, name);
+  if (opt) {
+    if (parse_float(value, opt->positive, &val))
+      return -EINVAL;
+    *(float *)((char *)config + opt->offset) = val;
+    return 0;
+  }
+
+  if (!strcmp(name, "nunchuk")) {
+    for (stick = 0; stick_names[stick]; stick++)
+      if (!strcmp(stick_names[stick], value))
+        break;
+    if (!stick_names[stick])
+      return -EINVAL;
+    /* the keys must be on the pointer for uinput to send them */
+    if (stick == CONFIG_STICK_WASD &&
+        (bind_code(&config->bindings, KEY_W) ||
+         bind_code(&config->bindings, KEY_A) ||
+         bind_code(&config->bindings, KEY_S) ||
+         bind_code(&config->bindings, KEY_D)))
+      return -ENOSPC;
+    for (m = 0; m < num_modes; m++)
+      if (mask & (1u << m))
+        config->stick[m] = stick;
+    return 0;
+  }
+
+  if (!strcmp(name, "stick_curve"))
+    return curve_parse(&config->stick_params, value);
+
+  if (!strcmp(name, "filter")) {
+    filter = filter_parse_type(value);
+    if (filter < 0)
+      return -EINVAL;
+    for (m = 0; m < num_modes; m++)
+      if (mask & (1u << m))
+        config->filter[m].type = filter;
+    return 0;
+  }
+
+  if (!strcmp(name, "steer_range")) {
+    if (parse_float(value, true, &val) || val > CONFIG_STEER_RANGE_MAX)
+      return -EINVAL;
+    config->steer_range = val;
+    return 0;
+  }
+
+  if (!strcmp(name, "steer_dead_zone"))
+    return parse_float(value, false, &config->steer_dead_zone);
+
+  if (!strcmp(name, "steer_curve"))
+    return curve_parse(&config->steer_params, value);
+
+  if (!strcmp(name, "pointer_accel")) {
+    if (mouse_accel_parse(&accel, value))
+      return -EINVAL;
+    for (m = 0; m < num_modes; m++)
+      if (mask & (1u << m))
+        config->accel_params[m] = accel;
+    return 0;
+  }
+
+  return -EINVAL;
+}
+
+/*
+ * Apply a config file on top of config. On error *line is the offending
+ * line and config may be partly updated. config_build() compiles the
+ * result.
+ */
+int config_load(struct config *config, FILE *file,
+                const char *const *modes, unsigned int num_modes,
+                unsigned int *line)
+{
+  char buf[CONFIG_LINE_MAX], *str, *eq, *end;
+  unsigned int mask = (1u << num_modes) - 1;
+  int key, ret;
+
+  if (num_modes > CONFIG_MODES)
+    return -EINVAL;
+
+  *line = 0;
+  while (fgets(buf, sizeof(buf), file)) {
+    ++*line;
+    if (!strchr(buf, '\n') && !feof(file))
+      return -E2BIG;
+    str = strchr(buf, '#');
+    if (str)
+      *str = 0;
+    str = trim(buf);
+    if (!*str)
+      continue;
+
+    if (*str == '[') {
+      end = strchr(str, ']');
+      if (!end || end[1])
+        return -EINVAL;
+      *end = 0;
+      ret = bind_modes(str + 1, modes, num_modes, &mask);
+      if (ret)
+        return ret;
+      continue;
+    }
+
+    eq = strchr(str, '=');
+    if (!eq)
+      return -EINVAL;
+    *eq = 0;
+    str = trim(str);
+    key = bind_key(str);
+    if (key >= 0)
+      ret = bind_set(&config->bindings, mask, key, trim(eq + 1), modes,
+                     num_modes);
+    else
+      ret = config_option(config, mask, num_modes, str, trim(eq + 1));
+    if (ret)
+      return ret;
+  }
+  if (ferror(file))
+    return -EIO;
+  if (config->steer_dead_zone >= config->steer_range ||
+      config->stick_dead_zone[0] >= CONFIG_STICK_RANGE ||
+      config->stick_dead_zone[1] >= CONFIG_STICK_RANGE ||
+      config->wasd_threshold > 1)
+    return -EINVAL;
+  return 0;
+}
+
+/*
+ * Compile what the options describe into lookup tables. Fails if a range
+ * leaves no room for a table, e.g. a dead zone just short of full range.
+ */
+int config_build(struct config *config)
+{
+  struct curve_params steer = config->steer_params;
+  struct curve_params stick = config->stick_params;
+  int32_t range = config->steer_range * CONFIG_STEER_UNITS;
+  unsigned int m;
+  int ret;
+
+  for (m = 0; m < CONFIG_MODES; m++)
+    mouse_accel_build(&config->accel[m], &config->accel_params[m]);
+
+  steer.range = range;
+  steer.scale = MOUSE_STICK_MAX;
+  ret = curve_build(&config->steer, &steer, -range, range, 0, false);
+  if (ret)
+    return ret;
+
+  stick.scale = 1;
+  for (m = 0; m < 2; m++) {
+    range = lroundf(CONFIG_STICK_RANGE - config->stick_dead_zone[m]);
+    stick.range = range;
+    ret = curve_build(&config->stick_curve[m], &stick, -range, range, 0,
+                      false);
+    if (ret)
+      return ret;
+  }
+  return 0;
+}
+
+static int config_load_path(struct config *config, unsigned int *line)
+{
+  FILE *file;
+  int ret;
+
+  *config = config_base;
+  *line = 0;
+  if (config_path) {
+    file = fopen(config_path, "re");
+    if (!file)
+      return -errno;
+    ret = config_load(config, file, config_modes, config_num_modes, line);
+    fclose(file);
+    if (ret)
+      return ret;
+  }
+  return config_build(config);
+}
+
+/*
+ * Load the first config: base, with the file at path on top if path is
+ * not NULL. Later reloads start from base again.
+ */
+int config_init(const struct config *base, const char *path,
+                const char *const *modes, unsigned int num_modes,
+                unsigned int *line)
+{
+  char tmp[PATH_MAX];
+  int ret;
+
+  if (num_modes > CONFIG_MODES)
+    return -EINVAL;
+
+  config_base = *base;
+  config_path = path;
+  config_modes = modes;
+  config_num_modes = num_modes;
+  ret = config_load_path(&config_buf[0], line);
+  if (ret)
+    return ret;
+
+  memcpy(config_codes, config_buf[0].bindings.codes, sizeof(config_codes));
+  atomic_store(&config_live, &config_buf[0]);
+
+  if (path) {
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    snprintf(config_dir, sizeof(config_dir), "%s", dirname(tmp));
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    snprintf(config_name, sizeof(config_name), "%s", basename(tmp));
+  }
+  return 0;
+}
+
+/*
+ * Wait until the main thread no longer holds the config replaced last.
+ * If it holds none right now, its next config_enter() sees the new one.
+ */
+static void config_synchronize(void)
+{
+  const struct timespec delay = { 0, CONFIG_GRACE_NS };
+  uint64_t seen = atomic_load(&config_reader);
+
+  if (!(seen & 1))
+    return;
+  while (atomic_load(&config_reader) == seen &&
+         !atomic_load(&config_stopping))
+    nanosleep(&delay, NULL);
+}
+
+/* keys the virtual devices were not created with are dropped by uinput */
+static void config_check_codes(const struct config *config)
+{
+  const int *code;
+  unsigned int i;
+
+  for (code = config->bindings.codes; *code >= 0; code++) {
+    /* the pointer always has the mouse buttons */
+    if (*code >= BTN_LEFT && *code <= BTN_EXTRA)
+      continue;
+    for (i = 0; config_codes[i] >= 0; i++)
+      if (config_codes[i] == *code)
+        break;
+    if (config_codes[i] < 0)
+      log_printf(LOG_LEVEL_ERROR, "Error: Key code %d needs a restart to "
+                 "be sent", *code);
+  }
+}
+
+static void config_reload(void)
+{
+  struct config *live = atomic_load(&config_live);
+  struct config *next = live == &config_buf[0] ? &config_buf[1] : &config_buf[0];
+  unsigned int line;
+  int ret;
+
+  ret = config_load_path(next, &line);
+  if (ret) {
+    log_printf(LOG_LEVEL_ERROR, "Error: Cannot reload %s, line %u: %d; "
+               "keeping the old config", config_path, line, ret);
+    return;
+  }
+  config_check_codes(next);
+
+  atomic_store(&config_live, next);
+  config_synchronize();
+  log_printf(LOG_LEVEL_INFO, "Info: Reloaded %s", config_path);
+}
+
+static void *config_main(void *arg)
+{
+  pthread_mutex_lock(&config_lock);
+  for (;;) {
+    while (!config_pending && !atomic_load(&config_stopping))
+      pthread_cond_wait(&config_cond, &config_lock);
+    if (atomic_load(&config_stopping))
+      break;
+    config_pending = false;
+    pthread_mutex_unlock(&config_lock);
+    config_reload();
+    pthread_mutex_lock(&config_lock);
+  }
+  pthread_mutex_unlock(&config_lock);
+  return NULL;
+}
+
+/*
+ * Watch the config file and start the reload thread. Returns the inotify
+ * fd for the caller's poll set, config_watch_dispatch() reads it.
+ */
+int config_watch_start(void)
+{
+  sigset_t mask, old;
+  int ret;
+
+  if (!config_path)
+    return -ENOENT;
+
+  config_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (config_inotify < 0)
+    return -errno;
+
+  /* editors often replace the file, so watch the directory */
+  if (inotify_add_watch(config_inotify, config_dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    ret = -errno;
+    goto err;
+  }
+
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  ret = -pthread_create(&config_thread, NULL, config_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (ret)
+    goto err;
+
+  config_running = true;
+  return config_inotify;
+
+err:
+  close(config_inotify);
+  config_inotify = -1;
+  return ret;
+}
+
+/* called when the inotify fd is readable, hands changes to the thread */
+void config_watch_dispatch(void)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+  bool changed = false;
+  ssize_t len;
+  char *p;
+
+  while ((len = read(config_inotify, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+      event = (const struct inotify_event *)p;
+      if (event->len && !strcmp(event->name, config_name))
+        changed = true;
+    }
+  }
+  if (!changed)
+    return;
+
+  pthread_mutex_lock(&config_lock);
+  config_pending = true;
+  pthread_cond_signal(&config_cond);
+  pthread_mutex_unlock(&config_lock);
+}
+
+void config_watch_stop(void)
+{
+  if (config_running) {
+    pthread_mutex_lock(&config_lock);
+    atomic_store(&config_stopping, true);
+    pthread_cond_signal(&config_cond);
+    pthread_mutex_unlock(&config_lock);
+    pthread_join(config_thread, NULL);
+    config_running = false;
+  }
+  if (config_inotify >= 0)
+    close(config_inotify);
+  config_inotify = -1;
+}
+
+/*
+ * The main thread's view of the config: held from config_enter() to
+ * config_leave(), which must come before anything that may block.
+ */
+const struct config *config_enter(void)
+{
+  atomic_fetch_add(&config_reader, 1);
+  return atomic_load(&config_live);
+}
+
+void config_leave(void)
+{
+  atomic_fetch_add(&config_reader, 1);
+}
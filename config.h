@@ -0,0 +1,74 @@
+#ifndef __WII_CONFIG_H__
+#define __WII_CONFIG_H__ 1
+
+#include <stdio.h>
+
+#include "bind.h"
+#include "curve.h"
+#include "filter.h"
+#include "gyro.h"
+#include "mouse.h"
+
+/* modes a config holds, the caller's mode count must not exceed it */
+#define CONFIG_MODES BIND_MODES_MAX
+/* steering table entries per degree, and the widest lock it covers */
+#define CONFIG_STEER_UNITS 10
+#define CONFIG_STEER_RANGE_MAX 180.0f
+/* nominal Nunchuk stick deflection, the kernel reports a little beyond it */
+#define CONFIG_STICK_RANGE 100
+
+/* what the Nunchuk stick does in a mode */
+enum config_stick {
+  CONFIG_STICK_OFF,
+  /* moves the pointer, stick_speed pixels per second at full deflection */
+  CONFIG_STICK_POINTER,
+  /* hi-res wheel and hwheel, scroll_speed detents per second */
+  CONFIG_STICK_SCROLL,
+  /* held W, A, S and D keys past wasd_threshold */
+  CONFIG_STICK_WASD,
+};
+
+/*
+ * Everything a config file can change. A config is never modified once it
+ * is live; a reload builds a new one and swaps it in as a whole.
+ */
+struct config {
+  struct bind_table bindings;
+  struct filter_params filter[CONFIG_MODES];
+  struct mouse_accel_params accel_params[CONFIG_MODES];
+  struct mouse_accel accel[CONFIG_MODES];
+  struct gyro_params gyro;
+  /*
+   * MODE_NFS steering: roll in degrees for full lock and the dead zone
+   * around straight ahead; the curve maps the rest onto the stick range,
+   * compiled into a table with CONFIG_STEER_UNITS entries per degree.
+   */
+  float steer_range, steer_dead_zone;
+  struct curve_params steer_params;
+  struct curve steer;
+  /*
+   * Nunchuk stick: per-axis dead zone in raw units, then the curve maps
+   * the rest onto -1..1, one table per axis as the dead zones differ.
+   */
+  uint8_t stick[CONFIG_MODES];
+  float stick_dead_zone[2];
+  struct curve_params stick_params;
+  struct curve stick_curve[2];
+  float stick_speed, scroll_speed, wasd_threshold;
+};
+
+int config_load(struct config *config, FILE *file,
+                const char *const *modes, unsigned int num_modes,
+                unsigned int *line);
+int config_build(struct config *config);
+
+int config_init(const struct config *base, const char *path,
+                const char *const *modes, unsigned int num_modes,
+                unsigned int *line);
+int config_watch_start(void);
+void config_watch_dispatch(void);
+void config_watch_stop(void);
+const struct config *config_enter(void);
+void config_leave(void);
+
+#endif /* __WII_CONFIG_H__ */
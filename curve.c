@@ -0,0 +1,148 @@
+/*
+ * Table-driven response curves
+ *
+ * Sensor values are small bounded integers, so a curve is evaluated once
+ * per possible input at startup and every sample afterwards is a table
+ * lookup instead of pow() and friends. Any curve shape compiles into the
+ * same kind of table.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "curve.h"
+
+static float curve_piecewise(const struct curve_params *params, float x)
+{
+  float x0 = 0, y0 = 0, x1, y1;
+  unsigned int i;
+
+  for (i = 0; i < params->num_points; i++) {
+    x1 = params->points[i][0];
+    y1 = params->points[i][1];
+    if (x <= x1)
+      return x1 > x0 ? y0 + (y1 - y0) * (x - x0) / (x1 - x0) : y1;
+    x0 = x1;
+    y0 = y1;
+  }
+  return y0;
+}
+
+/* exact curve value for a raw input */
+float curve_eval(const struct curve_params *params, float raw)
+{
+  float x = fabsf(raw / params->range), y, a, b;
+
+  switch (params->type) {
+  case CURVE_SCURVE:
+    /* x^k / (x^k + (1-x)^k): flat at 0 and 1, steeper for larger k */
+    x = fminf(x, 1.0f);
+    a = powf(x, params->exponent);
+    b = powf(1.0f - x, params->exponent);
+    y = a + b > 0 ? a / (a + b) : 0;
+    break;
+  case CURVE_PIECEWISE:
+    y = curve_piecewise(params, fminf(x, 1.0f));
+    break;
+  case CURVE_POWER:
+  default:
+    y = powf(x, params->exponent);
+    break;
+  }
+
+  y *= params->scale;
+  return raw < 0 ? -y : y;
+}
+
+int curve_build(struct curve *curve, const struct curve_params *params,
+                int32_t min, int32_t max, unsigned int shift,
+                bool interpolate)
+{
+  uint32_t span, step;
+  unsigned int i, num;
+
+  if (max <= min || shift > 16)
+    return -EINVAL;
+
+  span = (uint32_t)(max - min);
+  step = 1u << shift;
+  interpolate = interpolate && shift;
+  /* interpolating takes one entry past the one max falls on, so max
+   * always has a pair even when it lies exactly on an entry */
+  num = span / step + 1 + interpolate;
+  if (num > CURVE_TABLE_MAX)
+    return -E2BIG;
+
+  curve->min = min;
+  curve->max = max;
+  curve->shift = shift;
+  curve->interpolate = interpolate;
+  curve->step_inv = 1.0f / step;
+  curve->num = num;
+  for (i = 0; i < curve->num; i++)
+    curve->table[i] = curve_eval(params, (float)min + (float)i * step);
+
+  return 0;
+}
+
+float curve_apply(const struct curve *curve, int32_t raw)
+{
+  uint32_t off;
+  unsigned int i;
+  float lo;
+
+  if (raw <= curve->min)
+    return curve->table[0];
+  if (raw >= curve->max)
+    raw = curve->max;
+
+  off = (uint32_t)(raw - curve->min);
+  i = off >> curve->shift;
+  lo = curve->table[i];
+  if (!curve->interpolate)
+    return lo;
+
+  return lo + (curve->table[i + 1] - lo) *
+         (off & ((1u << curve->shift) - 1)) * curve->step_inv;
+}
+
+int curve_parse(struct curve_params *params, const char *spec)
+{
+  const char *arg = strchr(spec, ':');
+  char *end;
+  unsigned int n = 0;
+
+  if (!arg)
+    return -EINVAL;
+  arg++;
+
+  if (!strncmp(spec, "power:", 6) || !strncmp(spec, "scurve:", 7)) {
+    params->type = spec[0] == 'p' ? CURVE_POWER : CURVE_SCURVE;
+    params->exponent = strtof(arg, &end);
+    return *end || end == arg || params->exponent <= 0 ? -EINVAL : 0;
+  }
+
+  if (strncmp(spec, "piecewise:", 10))
+    return -EINVAL;
+
+  while (*arg && n < CURVE_POINTS_MAX) {
+    params->points[n][0] = strtof(arg, &end);
+    if (end == arg || *end != '=')
+      return -EINVAL;
+    arg = end + 1;
+    params->points[n][1] = strtof(arg, &end);
+    if (end == arg || (*end && *end != ','))
+      return -EINVAL;
+    if (n && params->points[n][0] <= params->points[n - 1][0])
+      return -EINVAL;
+    n++;
+    arg = *end ? end + 1 : end;
+  }
+  if (!n || *arg)
+    return -EINVAL;
+
+  params->type = CURVE_PIECEWISE;
+  params->num_points = n;
+  return 0;
+}
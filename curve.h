@@ -0,0 +1,58 @@
+#ifndef __WII_CURVE_H__
+#define __WII_CURVE_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* largest table a curve is compiled into */
+#define CURVE_TABLE_MAX 4097
+#define CURVE_POINTS_MAX 8
+
+enum curve_type {
+  /* scale * |x|^exponent */
+  CURVE_POWER,
+  /* slow around the center and near full range, fast in between */
+  CURVE_SCURVE,
+  /* straight lines between user points */
+  CURVE_PIECEWISE,
+};
+
+/*
+ * Response curve description. Input is normalized to x = raw / range; the
+ * curves are odd, the sign of the input is kept.
+ */
+struct curve_params {
+  enum curve_type type;
+  float range;
+  /* output at |x| == 1 */
+  float scale;
+  /* power exponent or S-curve steepness */
+  float exponent;
+  /* piecewise: (x, y) with x rising in 0..1, y in 0..1; (0, 0) implied */
+  unsigned int num_points;
+  float points[CURVE_POINTS_MAX][2];
+};
+
+/*
+ * A curve compiled into a table over the raw input domain. One entry every
+ * 2^shift raw units; inputs between entries take the lower one or, with
+ * interpolate, a linear blend. Inputs outside the domain are clamped.
+ */
+struct curve {
+  int32_t min, max;
+  unsigned int shift;
+  bool interpolate;
+  float step_inv;
+  unsigned int num;
+  float table[CURVE_TABLE_MAX];
+};
+
+float curve_eval(const struct curve_params *params, float raw);
+int curve_build(struct curve *curve, const struct curve_params *params,
+                int32_t min, int32_t max, unsigned int shift,
+                bool interpolate);
+float curve_apply(const struct curve *curve, int32_t raw);
+/* "power:<exp>", "scurve:<steepness>" or "piecewise:<x>=<y>,..." */
+int curve_parse(struct curve_params *params, const char *spec);
+
+#endif /* __WII_CURVE_H__ */
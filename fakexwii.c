@@ -0,0 +1,574 @@
+/*
+ * Fake libxwiimote
+ *
+ * A stand-in for the parts of the xwiimote.h API wiiremote uses, so the
+ * whole program builds and runs on hosts without Bluetooth or hid-wiimote
+ * ("make FAKE=1"). Remotes are either synthetic or replay a recorded trace.
+ * Like the real library, each remote hands out an epoll fd; behind it sits
+ * a timerfd at the report rate, or an always readable eventfd when reports
+ * are generated as fast as they are read.
+ *
+ * Configured from the environment:
+ *  WIIREMOTE_FAKE_REMOTES  number of remotes listed by the monitor (1)
+ *  WIIREMOTE_FAKE_RATE     reports per second up to 100000, 0 for unpaced (100)
+ *  WIIREMOTE_FAKE_REPORTS  synthetic reports before GONE, 0 for endless (0)
+ *  WIIREMOTE_FAKE_TRACE    replay this trace instead of synthetic motion
+ */
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xwiimote.h"
+#include "trace.h"
+
+#define FAKE_SYSPATH "/fake/xwiimote/%u"
+/* events of one report */
+#define FAKE_QUEUE 8
+/* synthetic pointer motion runs one circle per this many reports */
+#define FAKE_PERIOD 200
+/* A is pressed and released every this many reports */
+#define FAKE_KEY_PERIOD 150
+/* highest paced report rate */
+#define FAKE_RATE_MAX 100000
+
+struct xwii_iface {
+  unsigned int ref;
+  unsigned int index;
+  char syspath[32];
+
+  /* handed out by xwii_iface_get_fd() */
+  int efd;
+  /* timerfd when paced, eventfd when not */
+  int tick_fd;
+  bool paced;
+  /* unpaced: one report per wakeup, then -EAGAIN once */
+  bool burst_done;
+
+  unsigned int opened;
+  bool leds[4];
+  int32_t mp_norm[3];
+  int32_t mp_factor;
+
+  struct xwii_event queue[FAKE_QUEUE];
+  unsigned int head, num;
+  bool gone;
+
+  uint64_t reports;
+  /* trace replay: next record and the wall clock of the first one */
+  const struct trace_record *rec;
+  double t0, start;
+};
+
+struct xwii_monitor {
+  unsigned int ref;
+  unsigned int next;
+  int fd;
+};
+
+static struct {
+  bool loaded;
+  unsigned int remotes;
+  unsigned int rate;
+  unsigned int reports;
+  /* shared by all remotes, each picks its own records */
+  struct trace trace;
+  bool traced;
+} fake;
+
+/* a number from the environment, def if unset and when out of 0..max */
+static unsigned int fake_env(const char *name, unsigned int def,
+                             unsigned int max)
+{
+  const char *val = getenv(name);
+  unsigned long num;
+  char *end;
+
+  if (!val || !*val)
+    return def;
+  errno = 0;
+  num = strtoul(val, &end, 0);
+  if (errno || *end || *val == '-' || num > max) {
+    fprintf(stderr, "fakexwii: invalid %s=%s, using %u\n", name, val, def);
+    return def;
+  }
+  return num;
+}
+
+static void fake_load(void)
+{
+  const char *path = getenv("WIIREMOTE_FAKE_TRACE");
+
+  if (fake.loaded)
+    return;
+
+  fake.loaded = true;
+  fake.remotes = fake_env("WIIREMOTE_FAKE_REMOTES", 1, UINT_MAX);
+  fake.rate = fake_env("WIIREMOTE_FAKE_RATE", 100, FAKE_RATE_MAX);
+  fake.reports = fake_env("WIIREMOTE_FAKE_REPORTS", 0, UINT_MAX);
+  if (path && *path) {
+    if (trace_map(&fake.trace, path))
+      fprintf(stderr, "fakexwii: cannot map trace %s\n", path);
+    else
+      fake.traced = true;
+  }
+}
+
+static double fake_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void fake_time(struct timeval *tv, double t)
+{
+  tv->tv_sec = (time_t)t;
+  tv->tv_usec = (suseconds_t)((t - tv->tv_sec) * 1000000.0);
+}
+
+static double fake_event_time(const struct xwii_event *ev)
+{
+  return ev->time.tv_sec + ev->time.tv_usec / 1000000.0;
+}
+
+static struct xwii_event *fake_push(struct xwii_iface *dev, unsigned int type,
+                                    double t)
+{
+  struct xwii_event *ev = &dev->queue[dev->num++];
+
+  memset(ev, 0, sizeof(*ev));
+  fake_time(&ev->time, t);
+  ev->type = type;
+  return ev;
+}
+
+/* a slow circle: tilt, IR dots and rotation all follow the same phase */
+static void fake_synth(struct xwii_iface *dev)
+{
+  struct xwii_event *ev;
+  double t = fake_now();
+  float s, c;
+  int i;
+
+  s = sinf(2.0f * (float)M_PI * (dev->reports % FAKE_PERIOD) / FAKE_PERIOD);
+  c = cosf(2.0f * (float)M_PI * (dev->reports % FAKE_PERIOD) / FAKE_PERIOD);
+
+  if (dev->reports % FAKE_KEY_PERIOD == 0 ||
+      dev->reports % FAKE_KEY_PERIOD == FAKE_KEY_PERIOD / 2) {
+    ev = fake_push(dev, XWII_EVENT_KEY, t);
+    ev->v.key.code = XWII_KEY_A;
+    ev->v.key.state = dev->reports % FAKE_KEY_PERIOD == 0;
+  }
+
+  if (dev->opened & XWII_IFACE_ACCEL) {
+    ev = fake_push(dev, XWII_EVENT_ACCEL, t);
+    ev->v.abs[0].x = (int32_t)(30 * s);
+    ev->v.abs[0].y = (int32_t)(30 * c);
+    ev->v.abs[0].z = 100;
+  }
+
+  if (dev->opened & XWII_IFACE_IR) {
+    ev = fake_push(dev, XWII_EVENT_IR, t);
+    ev->v.abs[0].x = (int32_t)(412 + 200 * s);
+    ev->v.abs[0].y = (int32_t)(384 + 150 * c);
+    ev->v.abs[1].x = ev->v.abs[0].x + 200;
+    ev->v.abs[1].y = ev->v.abs[0].y;
+    for (i = 2; i < 4; i++)
+      ev->v.abs[i].x = ev->v.abs[i].y = 1023;
+  }
+
+  if (dev->opened & XWII_IFACE_MOTION_PLUS) {
+    ev = fake_push(dev, XWII_EVENT_MOTION_PLUS, t);
+    ev->v.abs[0].x = (int32_t)(3000 * c) + 40 + rand() % 16 - 8;
+    ev->v.abs[0].y = 20 + rand() % 16 - 8;
+    ev->v.abs[0].z = (int32_t)(3000 * s) - 25 + rand() % 16 - 8;
+  }
+}
+
+static bool fake_record_ours(const struct xwii_iface *dev,
+                             const struct trace_record *rec)
+{
+  return rec->dev == dev->index && rec->event.type != XWII_EVENT_WATCH &&
+         rec->event.type != XWII_EVENT_GONE;
+}
+
+/* skip to the next record of this remote and arm the timer for it */
+static void fake_trace_arm(struct xwii_iface *dev)
+{
+  const struct trace_record *end = fake.trace.records + fake.trace.num;
+  struct itimerspec its;
+  double due;
+
+  while (dev->rec < end && !fake_record_ours(dev, dev->rec))
+    dev->rec++;
+
+  if (!dev->paced || dev->gone)
+    return;
+
+  /* absolute CLOCK_REALTIME deadline of the next recorded report, right
+   * away once the trace is over so GONE gets delivered */
+  if (dev->rec < end)
+    due = dev->start + fake_event_time(&dev->rec->event) - dev->t0;
+  else
+    due = 0;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = (time_t)due;
+  its.it_value.tv_nsec = (long)((due - (time_t)due) * 1e9);
+  if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+    its.it_value.tv_nsec = 1;
+  timerfd_settime(dev->tick_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* queue all records of this remote with the timestamp of the next one */
+static void fake_replay(struct xwii_iface *dev)
+{
+  const struct trace_record *end = fake.trace.records + fake.trace.num;
+  struct xwii_event *ev;
+  double t;
+
+  /* one slot stays free for GONE after the last report */
+  if (dev->rec < end)
+    t = fake_event_time(&dev->rec->event);
+  while (dev->rec < end && dev->num < FAKE_QUEUE - 1 &&
+         fake_event_time(&dev->rec->event) == t) {
+    if (fake_record_ours(dev, dev->rec)) {
+      ev = fake_push(dev, dev->rec->event.type, 0);
+      ev->v = dev->rec->event.v;
+      fake_time(&ev->time, dev->start + t - dev->t0);
+    }
+    dev->rec++;
+  }
+
+  if (dev->rec >= end) {
+    fake_push(dev, XWII_EVENT_GONE, fake_now());
+    dev->gone = true;
+  }
+  fake_trace_arm(dev);
+}
+
+/* produce the next report if one is due, -EAGAIN if not */
+static int fake_refill(struct xwii_iface *dev)
+{
+  uint64_t ticks;
+
+  dev->head = dev->num = 0;
+  if (dev->gone)
+    return -EAGAIN;
+
+  if (dev->paced) {
+    if (read(dev->tick_fd, &ticks, sizeof(ticks)) < 0)
+      return -EAGAIN;
+  } else if (!dev->burst_done) {
+    dev->burst_done = true;
+    return -EAGAIN;
+  }
+  dev->burst_done = false;
+
+  if (fake.traced) {
+    fake_replay(dev);
+  } else {
+    if (fake.reports && dev->reports >= fake.reports) {
+      fake_push(dev, XWII_EVENT_GONE, fake_now());
+      dev->gone = true;
+    } else {
+      fake_synth(dev);
+    }
+  }
+  dev->reports++;
+
+  return dev->num ? 0 : -EAGAIN;
+}
+
+const char *xwii_get_iface_name(unsigned int iface)
+{
+  switch (iface) {
+  case XWII_IFACE_CORE:
+    return "Nintendo Wii Remote";
+  case XWII_IFACE_ACCEL:
+    return "Nintendo Wii Remote Accelerometer";
+  case XWII_IFACE_IR:
+    return "Nintendo Wii Remote IR";
+  case XWII_IFACE_MOTION_PLUS:
+    return "Nintendo Wii Remote Motion Plus";
+  case XWII_IFACE_NUNCHUK:
+    return "Nintendo Wii Remote Nunchuk";
+  case XWII_IFACE_CLASSIC_CONTROLLER:
+    return "Nintendo Wii Remote Classic Controller";
+  case XWII_IFACE_BALANCE_BOARD:
+    return "Nintendo Wii Remote Balance Board";
+  case XWII_IFACE_PRO_CONTROLLER:
+    return "Nintendo Wii Remote Pro Controller";
+  case XWII_IFACE_DRUMS:
+    return "Nintendo Wii Remote Drums";
+  case XWII_IFACE_GUITAR:
+    return "Nintendo Wii Remote Guitar";
+  default:
+    return NULL;
+  }
+}
+
+int xwii_iface_new(struct xwii_iface **dev, const char *syspath)
+{
+  struct xwii_iface *d;
+  struct epoll_event ev;
+  struct itimerspec its;
+  unsigned int index;
+  int ret;
+
+  fake_load();
+  if (sscanf(syspath, FAKE_SYSPATH, &index) != 1 || index >= fake.remotes)
+    return -ENODEV;
+
+  d = calloc(1, sizeof(*d));
+  if (!d)
+    return -ENOMEM;
+  d->ref = 1;
+  d->index = index;
+  snprintf(d->syspath, sizeof(d->syspath), FAKE_SYSPATH, index);
+
+  d->paced = fake.rate > 0;
+  if (d->paced)
+    d->tick_fd = timerfd_create(fake.traced ? CLOCK_REALTIME : CLOCK_MONOTONIC,
+                                TFD_NONBLOCK | TFD_CLOEXEC);
+  else
+    d->tick_fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+  d->efd = epoll_create1(EPOLL_CLOEXEC);
+  if (d->tick_fd < 0 || d->efd < 0)
+    goto err;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  if (epoll_ctl(d->efd, EPOLL_CTL_ADD, d->tick_fd, &ev) < 0)
+    goto err;
+
+  if (fake.traced) {
+    d->rec = fake.trace.records;
+    d->t0 = fake.trace.num ? fake_event_time(&fake.trace.records[0].event) : 0;
+    d->start = fake_now();
+    fake_trace_arm(d);
+  } else if (d->paced) {
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec = 1 / fake.rate;
+    its.it_interval.tv_nsec = fake.rate > 1 ? 1000000000L / fake.rate : 0;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(d->tick_fd, 0, &its, NULL) < 0)
+      goto err;
+  }
+
+  *dev = d;
+  return 0;
+
+err:
+  ret = -errno;
+  if (d->tick_fd >= 0)
+    close(d->tick_fd);
+  if (d->efd >= 0)
+    close(d->efd);
+  free(d);
+  return ret;
+}
+
+void xwii_iface_ref(struct xwii_iface *dev)
+{
+  dev->ref++;
+}
+
+void xwii_iface_unref(struct xwii_iface *dev)
+{
+  if (!dev || --dev->ref)
+    return;
+
+  close(dev->tick_fd);
+  close(dev->efd);
+  free(dev);
+}
+
+const char *xwii_iface_get_syspath(struct xwii_iface *dev)
+{
+  return dev->syspath;
+}
+
+int xwii_iface_get_fd(struct xwii_iface *dev)
+{
+  return dev->efd;
+}
+
+int xwii_iface_watch(struct xwii_iface *dev, bool watch)
+{
+  return 0;
+}
+
+int xwii_iface_open(struct xwii_iface *dev, unsigned int ifaces)
+{
+  dev->opened |= ifaces & xwii_iface_available(dev);
+  return 0;
+}
+
+void xwii_iface_close(struct xwii_iface *dev, unsigned int ifaces)
+{
+  dev->opened &= ~ifaces;
+}
+
+unsigned int xwii_iface_opened(struct xwii_iface *dev)
+{
+  return dev->opened;
+}
+
+unsigned int xwii_iface_available(struct xwii_iface *dev)
+{
+  if (fake.traced)
+    return XWII_IFACE_ALL;
+  return XWII_IFACE_CORE | XWII_IFACE_ACCEL | XWII_IFACE_IR |
+         XWII_IFACE_MOTION_PLUS;
+}
+
+int xwii_iface_poll(struct xwii_iface *dev, struct xwii_event *ev)
+{
+  return xwii_iface_dispatch(dev, ev, sizeof(*ev));
+}
+
+int xwii_iface_dispatch(struct xwii_iface *dev, struct xwii_event *ev,
+                        size_t size)
+{
+  struct xwii_event *next;
+  int ret;
+
+  if (!ev)
+    return 0;
+
+  if (dev->head == dev->num) {
+    ret = fake_refill(dev);
+    if (ret)
+      return ret;
+  }
+
+  next = &dev->queue[dev->head++];
+  if (next->type == XWII_EVENT_MOTION_PLUS) {
+    next->v.abs[0].x -= dev->mp_norm[0];
+    next->v.abs[0].y -= dev->mp_norm[1];
+    next->v.abs[0].z -= dev->mp_norm[2];
+  }
+
+  memset(ev, 0, size);
+  memcpy(ev, next, size < sizeof(*next) ? size : sizeof(*next));
+  return 0;
+}
+
+int xwii_iface_rumble(struct xwii_iface *dev, bool on)
+{
+  return 0;
+}
+
+int xwii_iface_get_led(struct xwii_iface *dev, unsigned int led, bool *state)
+{
+  if (led < XWII_LED1 || led > XWII_LED4)
+    return -EINVAL;
+  *state = dev->leds[led - XWII_LED1];
+  return 0;
+}
+
+int xwii_iface_set_led(struct xwii_iface *dev, unsigned int led, bool state)
+{
+  if (led < XWII_LED1 || led > XWII_LED4)
+    return -EINVAL;
+  dev->leds[led - XWII_LED1] = state;
+  return 0;
+}
+
+int xwii_iface_get_battery(struct xwii_iface *dev, uint8_t *capacity)
+{
+  *capacity = 100;
+  return 0;
+}
+
+int xwii_iface_get_devtype(struct xwii_iface *dev, char **devtype)
+{
+  *devtype = strdup("fake");
+  return *devtype ? 0 : -ENOMEM;
+}
+
+int xwii_iface_get_extension(struct xwii_iface *dev, char **extension)
+{
+  *extension = strdup(fake.traced ? "unknown" : "motionplus");
+  return *extension ? 0 : -ENOMEM;
+}
+
+void xwii_iface_set_mp_normalization(struct xwii_iface *dev, int32_t x,
+                                     int32_t y, int32_t z, int32_t factor)
+{
+  dev->mp_norm[0] = x;
+  dev->mp_norm[1] = y;
+  dev->mp_norm[2] = z;
+  dev->mp_factor = factor;
+}
+
+void xwii_iface_get_mp_normalization(struct xwii_iface *dev, int32_t *x,
+                                     int32_t *y, int32_t *z, int32_t *factor)
+{
+  if (x)
+    *x = dev->mp_norm[0];
+  if (y)
+    *y = dev->mp_norm[1];
+  if (z)
+    *z = dev->mp_norm[2];
+  if (factor)
+    *factor = dev->mp_factor;
+}
+
+/* the fake remotes are all there from the start, nothing is hotplugged */
+
+struct xwii_monitor *xwii_monitor_new(bool poll, bool direct)
+{
+  struct xwii_monitor *mon;
+
+  mon = calloc(1, sizeof(*mon));
+  if (!mon)
+    return NULL;
+  mon->ref = 1;
+  mon->fd = -1;
+  return mon;
+}
+
+void xwii_monitor_ref(struct xwii_monitor *mon)
+{
+  mon->ref++;
+}
+
+void xwii_monitor_unref(struct xwii_monitor *mon)
+{
+  if (!mon || --mon->ref)
+    return;
+
+  if (mon->fd >= 0)
+    close(mon->fd);
+  free(mon);
+}
+
+int xwii_monitor_get_fd(struct xwii_monitor *monitor, bool blocking)
+{
+  if (monitor->fd < 0)
+    monitor->fd = eventfd(0, EFD_CLOEXEC | (blocking ? 0 : EFD_NONBLOCK));
+  return monitor->fd;
+}
+
+char *xwii_monitor_poll(struct xwii_monitor *monitor)
+{
+  char path[32];
+
+  fake_load();
+  if (monitor->next >= fake.remotes)
+    return NULL;
+
+  snprintf(path, sizeof(path), FAKE_SYSPATH, monitor->next++);
+  return strdup(path);
+}
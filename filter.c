@@ -0,0 +1,107 @@
+/*
+ * Pointer stream filters
+ *
+ * Both filters run in constant time and space per sample:
+ *  - One Euro (Casiez et al. 2012): a low-pass filter whose cutoff rises
+ *    with speed. Jitter at rest is removed, fast moves get almost no lag.
+ *  - Kalman with a constant-velocity model: tracks position and velocity
+ *    and predicts through the noise instead of averaging it.
+ * Timestamps come from the events, so uneven report rates are handled.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "filter.h"
+
+/* gaps longer than this restart the filter instead of smoothing across them */
+#define FILTER_MAX_GAP 0.25
+
+void filter_reset(struct filter_axis *axis)
+{
+  memset(axis, 0, sizeof(*axis));
+}
+
+static float one_euro_alpha(float cutoff, float dt)
+{
+  float tau = 1.0f / (2 * M_PI * cutoff);
+
+  return 1.0f / (1.0f + tau / dt);
+}
+
+static float one_euro(const struct filter_params *params,
+                      struct filter_axis *axis, float value, float dt)
+{
+  float dx, cutoff, a;
+
+  dx = (value - axis->x) / dt;
+  a = one_euro_alpha(params->d_cutoff, dt);
+  axis->dx += a * (dx - axis->dx);
+
+  cutoff = params->min_cutoff + params->beta * fabsf(axis->dx);
+  a = one_euro_alpha(cutoff, dt);
+  axis->x += a * (value - axis->x);
+
+  return axis->x;
+}
+
+static float kalman(const struct filter_params *params,
+                    struct filter_axis *axis, float value, float dt)
+{
+  float q = params->process_noise, dt2 = dt * dt;
+  float p00, p01, p11, s, k0, k1, y;
+
+  /* predict: x += v*dt, P = F P F' + Q (white noise acceleration) */
+  axis->x += axis->dx * dt;
+  p00 = axis->p00 + dt * (2 * axis->p01 + dt * axis->p11) + q * dt2 * dt2 / 4;
+  p01 = axis->p01 + dt * axis->p11 + q * dt2 * dt / 2;
+  p11 = axis->p11 + q * dt2;
+
+  /* update with the measured position */
+  s = p00 + params->measure_noise;
+  k0 = p00 / s;
+  k1 = p01 / s;
+  y = value - axis->x;
+  axis->x += k0 * y;
+  axis->dx += k1 * y;
+
+  axis->p00 = (1 - k0) * p00;
+  axis->p01 = (1 - k0) * p01;
+  axis->p11 = p11 - k1 * p01;
+
+  return axis->x;
+}
+
+/* filter @value sampled at @t (seconds) and return the filtered value */
+float filter_apply(const struct filter_params *params, struct filter_axis *axis,
+                   float value, double t)
+{
+  double dt = t - axis->t;
+
+  if (params->type == FILTER_NONE)
+    return value;
+
+  if (!axis->valid || dt <= 0 || dt > FILTER_MAX_GAP) {
+    filter_reset(axis);
+    axis->valid = true;
+    axis->t = t;
+    axis->x = value;
+    axis->p00 = params->measure_noise;
+    return value;
+  }
+  axis->t = t;
+
+  if (params->type == FILTER_KALMAN)
+    return kalman(params, axis, value, dt);
+  return one_euro(params, axis, value, dt);
+}
+
+int filter_parse_type(const char *name)
+{
+  if (!strcmp(name, "none"))
+    return FILTER_NONE;
+  if (!strcmp(name, "euro"))
+    return FILTER_ONE_EURO;
+  if (!strcmp(name, "kalman"))
+    return FILTER_KALMAN;
+  return -1;
+}
@@ -0,0 +1,42 @@
+#ifndef __WII_FILTER_H__
+#define __WII_FILTER_H__ 1
+
+#include <stdbool.h>
+
+enum filter_type {
+  FILTER_NONE,
+  FILTER_ONE_EURO,
+  FILTER_KALMAN,
+};
+
+/* filter selection and tuning, shared by all axes of a pointer stream */
+struct filter_params {
+  enum filter_type type;
+  /* One Euro: cutoff at rest (Hz), speed coefficient, derivative cutoff */
+  float min_cutoff;
+  float beta;
+  float d_cutoff;
+  /* Kalman: acceleration noise density and measurement variance */
+  float process_noise;
+  float measure_noise;
+};
+
+/*
+ * Per-axis filter state. It is a fixed-size value, so streams embed one per
+ * axis and filtering never allocates.
+ */
+struct filter_axis {
+  bool valid;
+  double t;
+  /* One Euro: smoothed value/derivative; Kalman: position/velocity */
+  float x, dx;
+  /* Kalman error covariance */
+  float p00, p01, p11;
+};
+
+void filter_reset(struct filter_axis *axis);
+float filter_apply(const struct filter_params *params, struct filter_axis *axis,
+                   float value, double t);
+int filter_parse_type(const char *name);
+
+#endif /* __WII_FILTER_H__ */
@@ -0,0 +1,154 @@
+/*
+ * Accelerometer + gyro sensor fusion (Mahony complementary filter)
+ *
+ * Gyro reports integrate the orientation, the accelerometer pulls it back
+ * towards gravity with a proportional and an integral term (the latter
+ * soaks up remaining gyro bias). Without a MotionPlus, accelerometer reports
+ * drive the filter with zero rates and no integral term, which degrades to
+ * a smoothed tilt.
+ *
+ * One step is ~60 flops and a square root, cheap enough to run every report
+ * of several remotes on one core.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "fusion.h"
+
+/* feedback gains: proportional (1/s) and integral (1/s^2) */
+#define FUSION_KP 2.0f
+#define FUSION_KI 0.005f
+
+/* gaps longer than this are not integrated over */
+#define FUSION_MAX_DT 0.1
+
+/* gyro silent for this long: let the accelerometer drive the filter */
+#define FUSION_GYRO_TIMEOUT 0.1
+
+/*
+ * MotionPlus x/y/z rates in terms of rotation about the accelerometer axes
+ * (same pairing mp_pointer() uses: MP x turns the pointer horizontally, MP z
+ * vertically).
+ */
+#define FUSION_GYRO_X(r) ((r)->z)
+#define FUSION_GYRO_Y(r) ((r)->y)
+#define FUSION_GYRO_Z(r) ((r)->x)
+
+static const float fusion_rad_per_unit =
+    (float)M_PI / 180.0f / FUSION_MP_UNITS_PER_DPS;
+
+void fusion_init(struct fusion *fu)
+{
+  memset(fu, 0, sizeof(*fu));
+  fu->q[0] = 1.0f;
+}
+
+static void fusion_step(struct fusion *fu, float gx, float gy, float gz,
+                        float dt, bool gyro)
+{
+  float *q = fu->q, vx, vy, vz, ex, ey, ez, qw, qx, qy, qz, n;
+
+  if (fu->accel_ok) {
+    /* gravity direction predicted by the current orientation */
+    vx = 2 * (q[1] * q[3] - q[0] * q[2]);
+    vy = 2 * (q[0] * q[1] + q[2] * q[3]);
+    vz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+    /* error is the rotation between measured and predicted gravity */
+    ex = fu->accel[1] * vz - fu->accel[2] * vy;
+    ey = fu->accel[2] * vx - fu->accel[0] * vz;
+    ez = fu->accel[0] * vy - fu->accel[1] * vx;
+
+    gx += FUSION_KP * ex;
+    gy += FUSION_KP * ey;
+    gz += FUSION_KP * ez;
+
+    /* the integral estimates gyro bias, there is none to learn without one */
+    if (gyro) {
+      fu->bias[0] += FUSION_KI * ex * dt;
+      fu->bias[1] += FUSION_KI * ey * dt;
+      fu->bias[2] += FUSION_KI * ez * dt;
+      gx += fu->bias[0];
+      gy += fu->bias[1];
+      gz += fu->bias[2];
+    }
+  }
+
+  /* q += 0.5 * q * (0, g) * dt */
+  gx *= 0.5f * dt;
+  gy *= 0.5f * dt;
+  gz *= 0.5f * dt;
+  qw = q[0]; qx = q[1]; qy = q[2]; qz = q[3];
+  q[0] += -qx * gx - qy * gy - qz * gz;
+  q[1] += qw * gx + qy * gz - qz * gy;
+  q[2] += qw * gy - qx * gz + qz * gx;
+  q[3] += qw * gz + qx * gy - qy * gx;
+
+  n = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  q[0] *= n;
+  q[1] *= n;
+  q[2] *= n;
+  q[3] *= n;
+}
+
+/* start from the tilt the accelerometer reports instead of converging to it */
+static void fusion_align(struct fusion *fu)
+{
+  const float *a = fu->accel;
+  float roll = atan2f(a[1], a[2]) / 2;
+  float pitch = atan2f(-a[0], sqrtf(a[1] * a[1] + a[2] * a[2])) / 2;
+  float cr = cosf(roll), sr = sinf(roll), cp = cosf(pitch), sp = sinf(pitch);
+
+  fu->q[0] = cr * cp;
+  fu->q[1] = sr * cp;
+  fu->q[2] = cr * sp;
+  fu->q[3] = -sr * sp;
+}
+
+bool fusion_has_gyro(const struct fusion *fu, double t)
+{
+  return fu->t_gyro && t - fu->t_gyro < FUSION_GYRO_TIMEOUT;
+}
+
+void fusion_accel(struct fusion *fu, const struct xwii_event_abs *accel, double t)
+{
+  float n = sqrtf((float)accel->x * accel->x + (float)accel->y * accel->y +
+                  (float)accel->z * accel->z);
+  double dt = t - fu->t_accel;
+
+  fu->accel_ok = n > 0;
+  if (fu->accel_ok) {
+    fu->accel[0] = accel->x / n;
+    fu->accel[1] = accel->y / n;
+    fu->accel[2] = accel->z / n;
+  }
+  if (fu->accel_ok && !fu->t_accel && !fu->t_gyro)
+    fusion_align(fu);
+  fu->t_accel = t;
+
+  if (!fusion_has_gyro(fu, t) && dt > 0 && dt < FUSION_MAX_DT)
+    fusion_step(fu, 0, 0, 0, dt, false);
+}
+
+void fusion_gyro(struct fusion *fu, const struct xwii_event_abs *rate, double t)
+{
+  double dt = t - fu->t_gyro;
+
+  fu->t_gyro = t;
+  if (dt <= 0 || dt > FUSION_MAX_DT)
+    return;
+
+  fusion_step(fu, FUSION_GYRO_X(rate) * fusion_rad_per_unit,
+              FUSION_GYRO_Y(rate) * fusion_rad_per_unit,
+              FUSION_GYRO_Z(rate) * fusion_rad_per_unit, dt, true);
+}
+
+/* unit gravity vector in the remote's frame, as the accelerometer would see it at rest */
+void fusion_gravity(const struct fusion *fu, float *g)
+{
+  const float *q = fu->q;
+
+  g[0] = 2 * (q[1] * q[3] - q[0] * q[2]);
+  g[1] = 2 * (q[0] * q[1] + q[2] * q[3]);
+  g[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
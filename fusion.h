@@ -0,0 +1,32 @@
+#ifndef __WII_FUSION_H__
+#define __WII_FUSION_H__ 1
+
+#include <stdbool.h>
+#include "xwiimote.h"
+
+/* approximate MotionPlus units per degree/s (slow mode, hid-wiimote scaling) */
+#define FUSION_MP_UNITS_PER_DPS 180.0f
+
+/*
+ * Mahony orientation filter over accelerometer and MotionPlus reports.
+ * q is the orientation as a unit quaternion (w, x, y, z) in the remote's
+ * accelerometer frame: x to the right, y along the remote, z up.
+ */
+struct fusion {
+  float q[4];
+  /* integral feedback (gyro bias seen by the filter), rad/s */
+  float bias[3];
+  /* last normalized accelerometer direction, valid if accel_ok */
+  float accel[3];
+  bool accel_ok;
+  /* timestamps of the last gyro and accel step, in seconds */
+  double t_gyro, t_accel;
+};
+
+void fusion_init(struct fusion *fu);
+void fusion_accel(struct fusion *fu, const struct xwii_event_abs *accel, double t);
+void fusion_gyro(struct fusion *fu, const struct xwii_event_abs *rate, double t);
+void fusion_gravity(const struct fusion *fu, float *g);
+bool fusion_has_gyro(const struct fusion *fu, double t);
+
+#endif /* __WII_FUSION_H__ */
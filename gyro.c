@@ -0,0 +1,55 @@
+/*
+ * MotionPlus air mouse
+ *
+ * Angular rate maps to pointer velocity: nothing inside the dead zone, then
+ * a power curve normalised so that a rate of dead_zone + knee moves the
+ * pointer at the configured speed. Velocity is integrated over the real
+ * time between reports, so the result does not depend on the report rate.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "gyro.h"
+
+/* gaps longer than this (reconnect, clutch) are not integrated over */
+#define GYRO_MAX_DT 0.1
+
+void gyro_mouse_init(struct gyro_mouse *gyro)
+{
+  memset(gyro, 0, sizeof(*gyro));
+}
+
+static float gyro_speed(const struct gyro_params *params, float rate)
+{
+  float r = fabsf(rate) - params->dead_zone;
+
+  if (r <= 0)
+    return 0;
+
+  r = params->speed * powf(r / params->knee, params->exponent);
+  return rate < 0 ? -r : r;
+}
+
+/* pointer motion in pixels for the rates reported at @t (seconds) */
+void gyro_mouse_update(const struct gyro_params *params, struct gyro_mouse *gyro,
+                       float rate_x, float rate_y, double t,
+                       float *dx, float *dy)
+{
+  double dt = t - gyro->t;
+
+  *dx = 0;
+  *dy = 0;
+
+  if (!gyro->valid || dt <= 0 || dt > GYRO_MAX_DT) {
+    gyro->valid = true;
+    gyro->t = t;
+    return;
+  }
+  gyro->t = t;
+
+  if (gyro->released)
+    return;
+
+  *dx = gyro_speed(params, rate_x) * dt;
+  *dy = gyro_speed(params, rate_y) * dt;
+}
@@ -0,0 +1,33 @@
+#ifndef __WII_GYRO_H__
+#define __WII_GYRO_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Gyro air-mouse response. Rates are MotionPlus units as reported by
+ * xwiimote, speeds are pixels per second.
+ */
+struct gyro_params {
+  /* rates below this are treated as hand tremor and ignored */
+  float dead_zone;
+  /* rate (above the dead zone) at which the pointer moves at speed */
+  float knee;
+  float speed;
+  /* > 1 gives more precision for slow turns, 1 is linear */
+  float exponent;
+};
+
+struct gyro_mouse {
+  /* clutch released: pointer stays put while the remote is re-aimed */
+  bool released;
+  bool valid;
+  double t;
+};
+
+void gyro_mouse_init(struct gyro_mouse *gyro);
+void gyro_mouse_update(const struct gyro_params *params, struct gyro_mouse *gyro,
+                       float rate_x, float rate_y, double t,
+                       float *dx, float *dy);
+
+#endif /* __WII_GYRO_H__ */
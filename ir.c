@@ -0,0 +1,164 @@
+/*
+ * IR sensor bar pointing
+ *
+ * The IR camera tracks up to four light sources in 1024x768 camera space.
+ * The two dots of the sensor bar are picked out of the valid slots, rotated
+ * around the camera centre to undo the roll of the remote (taken from the
+ * orientation) and their midpoint becomes the absolute pointer position.
+ * If one dot drops out, the other one is extrapolated with the last known bar
+ * vector for a few reports, so the pointer does not jump at the screen edges.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "ir.h"
+
+/* reports to extrapolate from a single dot before dropping the lock */
+#define IR_LOST_MAX 20
+
+/*
+ * The bar only covers part of the camera's field of view at normal
+ * distances; scale the midpoint so the whole screen stays reachable.
+ */
+#define IR_GAIN 1.4f
+
+void ir_pointer_init(struct ir_pointer *ir)
+{
+  memset(ir, 0, sizeof(*ir));
+  ir->roll_cos = 1;
+  ir->x = IR_ABS_MAX / 2;
+  ir->y = IR_ABS_MAX / 2;
+}
+
+/*
+ * Gravity (as seen by the accelerometer, or from the fused orientation)
+ * gives the roll: lying flat it is all on Z, rolled by 90 degrees it is all
+ * on X. Only the direction is needed, so no trigonometry is involved.
+ */
+void ir_pointer_set_gravity(struct ir_pointer *ir, float x, float z)
+{
+  float len = hypotf(x, z);
+
+  /* pointing straight up or down, roll is undefined; keep the last one */
+  if (len < 1e-3f)
+    return;
+
+  ir->roll_sin = x / len;
+  ir->roll_cos = z / len;
+}
+
+/* camera coordinates -> roll-corrected coordinates around the centre */
+static void ir_unroll(const struct ir_pointer *ir, const struct xwii_event_abs *slot,
+                      float *out)
+{
+  float x = slot->x - IR_CAM_WIDTH / 2;
+  float y = slot->y - IR_CAM_HEIGHT / 2;
+
+  out[0] = x * ir->roll_cos - y * ir->roll_sin;
+  out[1] = x * ir->roll_sin + y * ir->roll_cos;
+}
+
+static float ir_dist2(const float *a, const float *b)
+{
+  float dx = a[0] - b[0], dy = a[1] - b[1];
+
+  return dx * dx + dy * dy;
+}
+
+/*
+ * Score a candidate pair (a left of b). While tracking, the pair closest to
+ * the last known dots wins. Without a lock, the sensor bar is the pair that
+ * is the most horizontal once the roll is undone.
+ */
+static float ir_pair_score(const struct ir_pointer *ir, const float *a, const float *b)
+{
+  if (ir->tracking)
+    return ir_dist2(a, ir->dot[0]) + ir_dist2(b, ir->dot[1]);
+
+  return fabsf(b[1] - a[1]) / (b[0] - a[0] + 1.0f);
+}
+
+static bool ir_pair_find(struct ir_pointer *ir, float pts[][2], int num)
+{
+  int i, j, l, r, best_l = -1, best_r = -1;
+  float score, best = 0;
+
+  for (i = 0; i < num; i++) {
+    for (j = i + 1; j < num; j++) {
+      l = pts[i][0] <= pts[j][0] ? i : j;
+      r = l == i ? j : i;
+      score = ir_pair_score(ir, pts[l], pts[r]);
+      if (best_l < 0 || score < best) {
+        best = score;
+        best_l = l;
+        best_r = r;
+      }
+    }
+  }
+
+  if (best_l < 0)
+    return false;
+
+  memcpy(ir->dot[0], pts[best_l], sizeof(ir->dot[0]));
+  memcpy(ir->dot[1], pts[best_r], sizeof(ir->dot[1]));
+  return true;
+}
+
+/* only one dot visible: move the bar along with it */
+static void ir_extrapolate(struct ir_pointer *ir, const float *pt)
+{
+  float bar[2];
+  int seen;
+
+  bar[0] = ir->dot[1][0] - ir->dot[0][0];
+  bar[1] = ir->dot[1][1] - ir->dot[0][1];
+  seen = ir_dist2(pt, ir->dot[0]) <= ir_dist2(pt, ir->dot[1]) ? 0 : 1;
+
+  memcpy(ir->dot[seen], pt, sizeof(ir->dot[seen]));
+  if (seen) {
+    ir->dot[0][0] = pt[0] - bar[0];
+    ir->dot[0][1] = pt[1] - bar[1];
+  } else {
+    ir->dot[1][0] = pt[0] + bar[0];
+    ir->dot[1][1] = pt[1] + bar[1];
+  }
+}
+
+static int ir_scale(float v)
+{
+  v = 0.5f + v * IR_GAIN;
+  v = (v < 0) ? 0 : ((v > 1) ? 1 : v);
+  return v * IR_ABS_MAX;
+}
+
+/*
+ * Feed the four IR slots of an XWII_EVENT_IR report. Returns true if the
+ * pointer position was updated.
+ */
+bool ir_pointer_update(struct ir_pointer *ir, const struct xwii_event_abs *slots)
+{
+  float pts[IR_SLOTS][2];
+  int i, num = 0;
+
+  for (i = 0; i < IR_SLOTS; i++) {
+    if (xwii_event_ir_is_valid(&slots[i]))
+      ir_unroll(ir, &slots[i], pts[num++]);
+  }
+
+  if (num >= 2 && ir_pair_find(ir, pts, num)) {
+    ir->tracking = true;
+    ir->lost = 0;
+  } else if (num == 1 && ir->tracking && ir->lost < IR_LOST_MAX) {
+    ir_extrapolate(ir, pts[0]);
+    ir->lost++;
+  } else {
+    if (ir->tracking && ++ir->lost >= IR_LOST_MAX)
+      ir->tracking = false;
+    return false;
+  }
+
+  /* the camera sees the bar move left when pointing right */
+  ir->x = ir_scale(-(ir->dot[0][0] + ir->dot[1][0]) / (2 * IR_CAM_WIDTH));
+  ir->y = ir_scale((ir->dot[0][1] + ir->dot[1][1]) / (2 * IR_CAM_HEIGHT));
+  return true;
+}
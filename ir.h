@@ -0,0 +1,36 @@
+#ifndef __WII_IR_H__
+#define __WII_IR_H__ 1
+
+#include <stdbool.h>
+#include "xwiimote.h"
+
+/* IR camera resolution and number of tracked slots */
+#define IR_CAM_WIDTH 1024
+#define IR_CAM_HEIGHT 768
+#define IR_SLOTS 4
+
+/* range of the absolute pointer axes */
+#define IR_ABS_MAX 32767
+
+/*
+ * Sensor bar tracker. Picks the two bar dots out of the four camera slots,
+ * follows them from frame to frame and turns their roll-corrected midpoint
+ * into an absolute pointer position.
+ */
+struct ir_pointer {
+  /* last known bar dots in camera coordinates, [0] left and [1] right */
+  float dot[2][2];
+  bool tracking;
+  /* reports since both dots were last seen */
+  unsigned int lost;
+  /* roll of the remote around its pointing axis */
+  float roll_sin, roll_cos;
+  /* pointer position in 0..IR_ABS_MAX */
+  int x, y;
+};
+
+void ir_pointer_init(struct ir_pointer *ir);
+void ir_pointer_set_gravity(struct ir_pointer *ir, float x, float z);
+bool ir_pointer_update(struct ir_pointer *ir, const struct xwii_event_abs *slots);
+
+#endif /* __WII_IR_H__ */
@@ -0,0 +1,208 @@
+/*
+ * Input-to-output latency histograms
+ *
+ * HDR-style log-linear buckets: 16 linear sub-buckets per power of two keep
+ * the relative error under 6.25% from 1 ns to 4 s with a fixed array of
+ * counters, so recording is one bucket computation and one atomic add.
+ */
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "latency.h"
+#include "log.h"
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1u << LATENCY_SUB_BITS)
+/* values from 2^LATENCY_EXP ns on share the last bucket */
+#define LATENCY_EXP 32
+#define LATENCY_BUCKETS ((LATENCY_EXP - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+/* events handled between two writes that are tracked */
+#define LATENCY_BATCH 256
+
+struct latency_hist {
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum;
+  _Atomic uint64_t max;
+  _Atomic uint64_t buckets[LATENCY_BUCKETS];
+};
+
+static struct latency_hist latency_hists[XWII_EVENT_NUM][LATENCY_STAGES];
+
+static struct {
+  unsigned int num;
+  struct {
+    unsigned int type;
+    uint64_t dispatched;
+  } events[LATENCY_BATCH];
+} latency_batch;
+
+static const char *latency_type_names[XWII_EVENT_NUM] = {
+  [XWII_EVENT_KEY] = "key",
+  [XWII_EVENT_ACCEL] = "accel",
+  [XWII_EVENT_IR] = "ir",
+  [XWII_EVENT_BALANCE_BOARD] = "bboard",
+  [XWII_EVENT_MOTION_PLUS] = "mp",
+  [XWII_EVENT_PRO_CONTROLLER_KEY] = "pro-key",
+  [XWII_EVENT_PRO_CONTROLLER_MOVE] = "pro-move",
+  [XWII_EVENT_WATCH] = "watch",
+  [XWII_EVENT_CLASSIC_CONTROLLER_KEY] = "classic-key",
+  [XWII_EVENT_CLASSIC_CONTROLLER_MOVE] = "classic-move",
+  [XWII_EVENT_NUNCHUK_KEY] = "nunchuk-key",
+  [XWII_EVENT_NUNCHUK_MOVE] = "nunchuk-move",
+  [XWII_EVENT_DRUMS_KEY] = "drums-key",
+  [XWII_EVENT_DRUMS_MOVE] = "drums-move",
+  [XWII_EVENT_GUITAR_KEY] = "guitar-key",
+  [XWII_EVENT_GUITAR_MOVE] = "guitar-move",
+  [XWII_EVENT_GONE] = "gone",
+};
+
+static const char *latency_stage_names[LATENCY_STAGES] = {
+  [LATENCY_KERNEL] = "kernel",
+  [LATENCY_PROCESS] = "process",
+  [LATENCY_OUTPUT] = "output",
+};
+
+uint64_t latency_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int latency_bucket(uint64_t ns)
+{
+  unsigned int e;
+
+  if (ns < LATENCY_SUB)
+    return ns;
+
+  e = 63 - __builtin_clzll(ns);
+  if (e >= LATENCY_EXP)
+    return LATENCY_BUCKETS - 1;
+  return (e - LATENCY_SUB_BITS + 1) * LATENCY_SUB +
+         ((ns >> (e - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+/* lowest value of a bucket */
+static uint64_t latency_bucket_value(unsigned int bucket)
+{
+  unsigned int e;
+
+  if (bucket < LATENCY_SUB)
+    return bucket;
+
+  e = bucket / LATENCY_SUB + LATENCY_SUB_BITS - 1;
+  return (uint64_t)(LATENCY_SUB + bucket % LATENCY_SUB) <<
+         (e - LATENCY_SUB_BITS);
+}
+
+void latency_record(unsigned int type, enum latency_stage stage, uint64_t ns)
+{
+  struct latency_hist *hist;
+  uint64_t max;
+
+  if (type >= XWII_EVENT_NUM)
+    return;
+
+  hist = &latency_hists[type][stage];
+  atomic_fetch_add_explicit(&hist->buckets[latency_bucket(ns)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, ns, memory_order_relaxed);
+
+  max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  while (ns > max &&
+         !atomic_compare_exchange_weak_explicit(&hist->max, &max, ns,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+    ;
+}
+
+void latency_dispatched(const struct xwii_event *event)
+{
+  struct timeval now;
+  int64_t ns;
+
+  /* the kernel stamps events with the realtime clock */
+  gettimeofday(&now, NULL);
+  ns = (int64_t)(now.tv_sec - event->time.tv_sec) * 1000000000 +
+       (int64_t)(now.tv_usec - event->time.tv_usec) * 1000;
+  if (ns >= 0)
+    latency_record(event->type, LATENCY_KERNEL, ns);
+}
+
+void latency_processed(unsigned int type, uint64_t dispatched)
+{
+  uint64_t now = latency_now();
+  unsigned int n = latency_batch.num;
+
+  latency_record(type, LATENCY_PROCESS, now - dispatched);
+
+  if (n < LATENCY_BATCH) {
+    latency_batch.events[n].type = type;
+    latency_batch.events[n].dispatched = dispatched;
+    latency_batch.num = n + 1;
+  }
+}
+
+void latency_written(void)
+{
+  uint64_t now;
+  unsigned int n;
+
+  if (!latency_batch.num)
+    return;
+
+  now = latency_now();
+  for (n = 0; n < latency_batch.num; n++)
+    latency_record(latency_batch.events[n].type, LATENCY_OUTPUT,
+                   now - latency_batch.events[n].dispatched);
+  latency_batch.num = 0;
+}
+
+static double latency_percentile(const struct latency_hist *hist,
+                                 uint64_t count, double p)
+{
+  uint64_t rank = (uint64_t)(count * p), seen = 0;
+  unsigned int b;
+
+  for (b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += atomic_load_explicit(&hist->buckets[b], memory_order_relaxed);
+    if (seen > rank)
+      return latency_bucket_value(b) / 1000.0;
+  }
+  return atomic_load_explicit(&hist->max, memory_order_relaxed) / 1000.0;
+}
+
+void latency_dump(void)
+{
+  const struct latency_hist *hist;
+  unsigned int type, stage;
+  uint64_t count;
+
+  log_printf(LOG_LEVEL_INFO,
+             "Info: latency in us (count mean p50 p90 p99 p99.9 max)");
+  for (type = 0; type < XWII_EVENT_NUM; type++) {
+    for (stage = 0; stage < LATENCY_STAGES; stage++) {
+      hist = &latency_hists[type][stage];
+      count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+      if (!count)
+        continue;
+
+      log_printf(LOG_LEVEL_INFO,
+                 "  %-12s %-7s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f",
+                 latency_type_names[type] ? latency_type_names[type] : "?",
+                 latency_stage_names[stage], (unsigned long long)count,
+                 atomic_load_explicit(&hist->sum, memory_order_relaxed) /
+                 1000.0 / count,
+                 latency_percentile(hist, count, 0.5),
+                 latency_percentile(hist, count, 0.9),
+                 latency_percentile(hist, count, 0.99),
+                 latency_percentile(hist, count, 0.999),
+                 atomic_load_explicit(&hist->max, memory_order_relaxed) /
+                 1000.0);
+    }
+  }
+}
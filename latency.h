@@ -0,0 +1,35 @@
+#ifndef __WII_LATENCY_H__
+#define __WII_LATENCY_H__ 1
+
+#include <stdint.h>
+#include "xwiimote.h"
+
+enum latency_stage {
+  /* kernel timestamp to xwii_iface_dispatch() returning it */
+  LATENCY_KERNEL,
+  /* dispatch to the handler returning */
+  LATENCY_PROCESS,
+  /* dispatch to the output write after it */
+  LATENCY_OUTPUT,
+  LATENCY_STAGES,
+};
+
+/* CLOCK_MONOTONIC in ns */
+uint64_t latency_now(void);
+
+/*
+ * Histograms are updated with atomic adds and may be fed from any thread.
+ * The batch of events waiting for the next write belongs to the thread
+ * that processes and writes them.
+ */
+void latency_record(unsigned int type, enum latency_stage stage, uint64_t ns);
+/* event just read from the remote, accounts the kernel stage */
+void latency_dispatched(const struct xwii_event *event);
+/* event handled, its output stage ends with the next latency_written() */
+void latency_processed(unsigned int type, uint64_t dispatched);
+void latency_written(void);
+
+/* print percentiles of everything recorded so far */
+void latency_dump(void);
+
+#endif /* __WII_LATENCY_H__ */
@@ -0,0 +1,438 @@
+/*
+ * Asynchronous logging
+ *
+ * Producers claim a slot of a bounded multi-producer ring with one CAS
+ * (Vyukov's sequence-numbered queue) and store the format pointer plus the
+ * raw arguments. A background thread formats and writes the records, so a
+ * slow terminal or journal never blocks the caller. A full ring drops the
+ * record and counts it. Without the thread, before log_start(), after
+ * log_stop() or when it could not be started, messages are written right
+ * away instead.
+ *
+ * An idle log thread blocks on an eventfd. It announces that with a flag
+ * before its last look at the ring, so only a producer that finds the flag
+ * set pays for the write() that wakes it.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/* number of records, must be a power of two */
+#define LOG_RING_SIZE 1024
+#define LOG_ARGS_MAX 10
+/* bytes of %s arguments copied per record */
+#define LOG_STR_MAX 128
+
+union log_arg {
+  long long i;
+  double d;
+  const void *p;
+  /* offset of a copied string in the record */
+  size_t s;
+};
+
+struct log_entry {
+  /* slot free when seq == pos, filled when seq == pos + 1 */
+  _Atomic unsigned int seq;
+  int level;
+  unsigned int nargs;
+  const char *format;
+  union log_arg args[LOG_ARGS_MAX];
+  char str[LOG_STR_MAX];
+};
+
+/* one printf conversion of a format */
+struct log_spec {
+  /* '%' up to and including the precision */
+  const char *start;
+  size_t len;
+  /* length modifier */
+  char mod[3];
+  char conv;
+};
+
+int log_level = LOG_LEVEL_INFO;
+
+static struct log_entry log_ring[LOG_RING_SIZE];
+static _Atomic unsigned int log_head;
+static unsigned int log_tail;
+static _Atomic uint64_t log_dropped;
+
+static FILE *log_out;
+static pthread_t log_thread;
+static atomic_bool log_stopping;
+static atomic_bool log_running;
+/* log thread is about to block on log_wake_fd */
+static atomic_bool log_sleeping;
+static int log_wake_fd = -1;
+
+/* parse the conversion at p (just past '%'), returns the rest */
+static const char *log_parse(const char *p, struct log_spec *spec)
+{
+  size_t n;
+
+  spec->start = p - 1;
+  p += strspn(p, "-+ #0123456789.");
+  spec->len = p - spec->start;
+
+  n = strspn(p, "hlLqjzt");
+  if (n > 2)
+    n = 2;
+  memcpy(spec->mod, p, n);
+  spec->mod[n] = 0;
+  p += n;
+
+  spec->conv = *p;
+  return *p ? p + 1 : p;
+}
+
+static long long log_arg_signed(const char *mod, va_list *list)
+{
+  if (!strcmp(mod, "l"))
+    return va_arg(*list, long);
+  if (!strcmp(mod, "ll") || !strcmp(mod, "q"))
+    return va_arg(*list, long long);
+  if (!strcmp(mod, "j"))
+    return va_arg(*list, intmax_t);
+  if (!strcmp(mod, "z"))
+    return va_arg(*list, ssize_t);
+  if (!strcmp(mod, "t"))
+    return va_arg(*list, ptrdiff_t);
+  return va_arg(*list, int);
+}
+
+static long long log_arg_unsigned(const char *mod, va_list *list)
+{
+  if (!strcmp(mod, "l"))
+    return va_arg(*list, unsigned long);
+  if (!strcmp(mod, "ll") || !strcmp(mod, "q"))
+    return va_arg(*list, unsigned long long);
+  if (!strcmp(mod, "j"))
+    return va_arg(*list, uintmax_t);
+  if (!strcmp(mod, "z"))
+    return va_arg(*list, size_t);
+  if (!strcmp(mod, "t"))
+    return va_arg(*list, ptrdiff_t);
+  return va_arg(*list, unsigned int);
+}
+
+/* copy the arguments into the record, strings into its own buffer */
+static void log_capture(struct log_entry *entry, va_list *list)
+{
+  const char *p = entry->format, *str;
+  struct log_spec spec;
+  union log_arg *arg;
+  size_t used = 0, len;
+
+  entry->nargs = 0;
+  while ((p = strchr(p, '%')) && entry->nargs < LOG_ARGS_MAX) {
+    p = log_parse(p + 1, &spec);
+    arg = &entry->args[entry->nargs];
+
+    switch (spec.conv) {
+    case 'd':
+    case 'i':
+      arg->i = log_arg_signed(spec.mod, list);
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      arg->i = log_arg_unsigned(spec.mod, list);
+      break;
+    case 'c':
+      arg->i = va_arg(*list, int);
+      break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      if (!strcmp(spec.mod, "L"))
+        arg->d = va_arg(*list, long double);
+      else
+        arg->d = va_arg(*list, double);
+      break;
+    case 'p':
+      arg->p = va_arg(*list, void *);
+      break;
+    case 's':
+      str = va_arg(*list, const char *);
+      if (!str)
+        str = "(null)";
+      len = strnlen(str, LOG_STR_MAX - 1 - used);
+      memcpy(entry->str + used, str, len);
+      entry->str[used + len] = 0;
+      arg->s = used;
+      used += len + (used + len < LOG_STR_MAX - 1);
+      break;
+    default:
+      /* "%%" or unknown, takes no argument */
+      continue;
+    }
+    entry->nargs++;
+  }
+}
+
+static void log_wake(void)
+{
+  uint64_t one = 1;
+
+  ssize_t ret;
+
+  /* nowhere to report a failure; the records wait for the next wake-up */
+  ret = write(log_wake_fd, &one, sizeof(one));
+  (void)ret;
+}
+
+/* no log thread: format and write in the caller */
+static void log_write(const char *format, va_list *list)
+{
+  FILE *out = log_out ? log_out : stdout;
+
+  flockfile(out);
+  vfprintf(out, format, *list);
+  fputc('\n', out);
+  fflush(out);
+  funlockfile(out);
+}
+
+void log_record(int level, const char *format, ...)
+{
+  struct log_entry *entry;
+  unsigned int pos, seq;
+  va_list list;
+
+  if (!atomic_load(&log_running)) {
+    va_start(list, format);
+    log_write(format, &list);
+    va_end(list);
+    return;
+  }
+
+  pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+  for (;;) {
+    entry = &log_ring[pos & (LOG_RING_SIZE - 1)];
+    seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+    if (seq == pos) {
+      if (atomic_compare_exchange_weak_explicit(&log_head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if ((int)(seq - pos) < 0) {
+      atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+    }
+  }
+
+  entry->level = level;
+  entry->format = format;
+  va_start(list, format);
+  log_capture(entry, &list);
+  va_end(list);
+
+  atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+
+  /* pairs with the fence in log_main(): either it sees the record or we
+   * see it going to sleep */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&log_sleeping, memory_order_relaxed))
+    log_wake();
+}
+
+/* print one conversion; ints are widened to long long */
+static void log_print_arg(const struct log_entry *entry,
+                          const struct log_spec *spec,
+                          const union log_arg *arg)
+{
+  char fmt[32];
+  size_t len = spec->len;
+
+  if (len > sizeof(fmt) - 4)
+    len = sizeof(fmt) - 4;
+  memcpy(fmt, spec->start, len);
+
+  switch (spec->conv) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    fmt[len++] = 'l';
+    fmt[len++] = 'l';
+    fmt[len++] = spec->conv;
+    fmt[len] = 0;
+    fprintf(log_out, fmt, arg->i);
+    break;
+  case 'c':
+    fmt[len++] = 'c';
+    fmt[len] = 0;
+    fprintf(log_out, fmt, (int)arg->i);
+    break;
+  case 's':
+    fmt[len++] = 's';
+    fmt[len] = 0;
+    fprintf(log_out, fmt, entry->str + arg->s);
+    break;
+  case 'p':
+    fmt[len++] = 'p';
+    fmt[len] = 0;
+    fprintf(log_out, fmt, arg->p);
+    break;
+  default:
+    fmt[len++] = spec->conv;
+    fmt[len] = 0;
+    fprintf(log_out, fmt, arg->d);
+    break;
+  }
+}
+
+static void log_format(const struct log_entry *entry)
+{
+  const char *p = entry->format, *next;
+  struct log_spec spec;
+  unsigned int n = 0;
+
+  while (*p) {
+    next = strchr(p, '%');
+    if (!next)
+      next = p + strlen(p);
+    fwrite(p, 1, next - p, log_out);
+    if (!*next)
+      break;
+
+    p = log_parse(next + 1, &spec);
+    if (spec.conv == '%')
+      fputc('%', log_out);
+    else if (n < entry->nargs && strchr("diouxXceEfFgGaAps", spec.conv))
+      log_print_arg(entry, &spec, &entry->args[n++]);
+    else
+      fwrite(spec.start, 1, p - spec.start, log_out);
+  }
+  fputc('\n', log_out);
+}
+
+/* single consumer: write everything queued so far */
+static unsigned int log_drain(void)
+{
+  struct log_entry *entry;
+  unsigned int num = 0;
+
+  for (;;) {
+    entry = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+    if (atomic_load_explicit(&entry->seq, memory_order_acquire) !=
+        log_tail + 1)
+      break;
+
+    log_format(entry);
+    atomic_store_explicit(&entry->seq, log_tail + LOG_RING_SIZE,
+                          memory_order_release);
+    ++log_tail;
+    ++num;
+  }
+
+  if (num)
+    fflush(log_out);
+  return num;
+}
+
+static void *log_main(void *arg)
+{
+  uint64_t count;
+
+  for (;;) {
+    if (log_drain())
+      continue;
+
+    atomic_store_explicit(&log_sleeping, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (log_drain()) {
+      atomic_store_explicit(&log_sleeping, false, memory_order_relaxed);
+      continue;
+    }
+    if (atomic_load(&log_stopping)) {
+      atomic_store(&log_sleeping, false);
+      break;
+    }
+    if (read(log_wake_fd, &count, sizeof(count)) < 0 && errno != EINTR)
+      break;
+    atomic_store_explicit(&log_sleeping, false, memory_order_relaxed);
+  }
+
+  return NULL;
+}
+
+int log_start(FILE *out)
+{
+  sigset_t mask, old;
+  unsigned int i;
+  int ret;
+
+  for (i = 0; i < LOG_RING_SIZE; i++)
+    atomic_init(&log_ring[i].seq, i);
+  log_out = out;
+
+  log_wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (log_wake_fd < 0)
+    return -errno;
+
+  /* signals are for the threads doing the work, not the log thread */
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  ret = pthread_create(&log_thread, NULL, log_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (ret) {
+    close(log_wake_fd);
+    log_wake_fd = -1;
+    return -ret;
+  }
+
+  atomic_store(&log_running, true);
+  return 0;
+}
+
+void log_stop(void)
+{
+  uint64_t dropped;
+
+  if (!atomic_load(&log_running))
+    return;
+
+  /* later messages are written directly, what raced in is drained here */
+  atomic_store(&log_running, false);
+  atomic_store(&log_stopping, true);
+  log_wake();
+  pthread_join(log_thread, NULL);
+
+  /* a producer may have claimed a slot and not published it yet */
+  for (;;) {
+    log_drain();
+    if (log_tail == atomic_load(&log_head))
+      break;
+    sched_yield();
+  }
+
+  dropped = atomic_load(&log_dropped);
+  if (dropped)
+    fprintf(log_out, "Info: %" PRIu64 " log records dropped\n", dropped);
+  fflush(log_out);
+}
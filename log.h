@@ -0,0 +1,38 @@
+#ifndef __WII_LOG_H__
+#define __WII_LOG_H__ 1
+
+#include <stdio.h>
+
+enum log_level {
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG,
+  /* per-event output, e.g. every sensor sample */
+  LOG_LEVEL_TRACE,
+};
+
+/* messages above this level are discarded */
+extern int log_level;
+
+/*
+ * Queue a message for the log thread. Only the arguments are copied into a
+ * preallocated record, %s strings included; formatting and the write happen
+ * on the log thread. The format must be a string literal, '*' widths are
+ * not supported. A disabled level costs the one comparison.
+ */
+#define log_printf(level, ...)                  \
+  do {                                          \
+    if ((level) <= log_level)                   \
+      log_record((level), __VA_ARGS__);         \
+  } while (0)
+
+void log_record(int level, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/* start the log thread writing to out; until then messages go to stdout
+ * synchronously, and so they do after log_stop() */
+int log_start(FILE *out);
+/* write what is still queued and stop the log thread */
+void log_stop(void);
+
+#endif /* __WII_LOG_H__ */
@@ -6,38 +6,346 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <linux/input.h>
+#include <linux/uinput.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 
 #include "mouse.h"
 
-static void send_event(int fd, int type, int code, int value)
+void mouse_frame_init(struct mouse_frame *frame, int fd)
+{
+  frame->fd = fd;
+  frame->num = 0;
+}
+
+void mouse_frame_add(struct mouse_frame *frame, int type, int code, int value)
+{
+  struct input_event *event;
+
+  /* keep one slot free for the SYN_REPORT terminating the frame */
+  if (frame->num >= MOUSE_FRAME_MAX - 1)
+    mouse_frame_flush(frame);
+
+  event = &frame->ev[frame->num++];
+  event->type = type;
+  event->code = code;
+  event->value = value;
+}
+
+void mouse_frame_rel(struct mouse_frame *frame, int x, int y)
+{
+  if (x)
+    mouse_frame_add(frame, EV_REL, REL_X, x);
+  if (y)
+    mouse_frame_add(frame, EV_REL, REL_Y, y);
+}
+
+/*
+ * Terminate the frame with SYN_REPORT, stamp all events with one timestamp
+ * and write them out with a single syscall. Empty frames are not written.
+ */
+int mouse_frame_flush(struct mouse_frame *frame)
+{
+  struct timeval now;
+  unsigned int i, num = frame->num;
+  ssize_t len;
+
+  if (!num)
+    return 0;
+  frame->num = 0;
+
+  frame->ev[num].type = EV_SYN;
+  frame->ev[num].code = SYN_REPORT;
+  frame->ev[num].value = 0;
+  ++num;
+
+  gettimeofday(&now, NULL);
+  for (i = 0; i < num; i++)
+    frame->ev[i].time = now;
+
+  if (frame->fd < 0)
+    return 0;
+
+  do {
+    len = write(frame->fd, frame->ev, num * sizeof(frame->ev[0]));
+  } while (len < 0 && errno == EINTR);
+
+  if (len < 0)
+    return -errno;
+  /* uinput takes whole events, a partial frame would lose its SYN_REPORT */
+  return (size_t)len == num * sizeof(frame->ev[0]) ? 0 : -EIO;
+}
+
+/* time between flushes used for the pointer speed, in seconds */
+#define MOUSE_ACCEL_DT_MIN 0.001
+#define MOUSE_ACCEL_DT_MAX 0.05
+
+/* defaults of the adaptive profile, in pixels per second */
+#define MOUSE_ACCEL_THRESHOLD 200.0f
+#define MOUSE_ACCEL_MAX_SPEED 2000.0f
+
+static float accel_eval(const struct mouse_accel_params *params, float speed)
+{
+  const float (*p)[2] = params->points;
+  unsigned int i;
+
+  switch (params->profile) {
+  case MOUSE_ACCEL_ADAPTIVE:
+    if (speed <= params->threshold)
+      return params->gain;
+    if (speed >= params->max_speed)
+      return params->max_gain;
+    return params->gain + (params->max_gain - params->gain) *
+      (speed - params->threshold) / (params->max_speed - params->threshold);
+  case MOUSE_ACCEL_CUSTOM:
+    if (speed <= p[0][0])
+      return p[0][1];
+    for (i = 1; i < params->num_points; i++)
+      if (speed <= p[i][0])
+        return p[i - 1][1] + (p[i][1] - p[i - 1][1]) *
+          (speed - p[i - 1][0]) / (p[i][0] - p[i - 1][0]);
+    return p[params->num_points - 1][1];
+  default:
+    return params->gain;
+  }
+}
+
+/*
+ * Sample the gain of a profile into a table, so the output path does a
+ * lookup instead of walking the profile for every frame.
+ */
+void mouse_accel_build(struct mouse_accel *accel,
+                       const struct mouse_accel_params *params)
+{
+  float span = 0;
+  unsigned int i;
+
+  if (params->profile == MOUSE_ACCEL_ADAPTIVE)
+    span = params->max_speed;
+  else if (params->profile == MOUSE_ACCEL_CUSTOM)
+    span = params->points[params->num_points - 1][0];
+  if (span <= 0)
+    span = 1;
+
+  accel->step_inv = (MOUSE_ACCEL_TABLE - 1) / span;
+  for (i = 0; i < MOUSE_ACCEL_TABLE; i++)
+    accel->gain[i] = accel_eval(params, i / accel->step_inv);
+}
+
+float mouse_accel_gain(const struct mouse_accel *accel, float speed)
+{
+  float pos = speed * accel->step_inv;
+  unsigned int i;
+
+  if (pos >= MOUSE_ACCEL_TABLE - 1)
+    return accel->gain[MOUSE_ACCEL_TABLE - 1];
+  i = pos;
+  return accel->gain[i] + (pos - i) * (accel->gain[i + 1] - accel->gain[i]);
+}
+
+/*
+ * Parse "flat:<gain>", "adaptive:<max_gain>[,<threshold>[,<max_speed>]]" or
+ * "custom:<speed>=<gain>,..." with speeds rising.
+ */
+int mouse_accel_parse(struct mouse_accel_params *params, const char *spec)
+{
+  const char *arg = strchr(spec, ':');
+  float *vals[3];
+  char *end;
+  unsigned int n = 0;
+
+  if (!arg)
+    return -EINVAL;
+  arg++;
+
+  if (!strncmp(spec, "flat:", 5)) {
+    params->profile = MOUSE_ACCEL_FLAT;
+    params->gain = strtof(arg, &end);
+    return *end || end == arg || params->gain <= 0 ? -EINVAL : 0;
+  }
+
+  if (!strncmp(spec, "adaptive:", 9)) {
+    params->profile = MOUSE_ACCEL_ADAPTIVE;
+    params->gain = 1;
+    params->threshold = MOUSE_ACCEL_THRESHOLD;
+    params->max_speed = MOUSE_ACCEL_MAX_SPEED;
+    vals[0] = &params->max_gain;
+    vals[1] = &params->threshold;
+    vals[2] = &params->max_speed;
+    while (n < 3) {
+      *vals[n++] = strtof(arg, &end);
+      if (end == arg || (*end && *end != ','))
+        return -EINVAL;
+      arg = end;
+      if (!*arg++)
+        break;
+    }
+    if (*end || params->max_gain <= 0 || params->threshold < 0 ||
+        params->max_speed <= params->threshold)
+      return -EINVAL;
+    return 0;
+  }
+
+  if (strncmp(spec, "custom:", 7))
+    return -EINVAL;
+
+  while (*arg && n < MOUSE_ACCEL_POINTS_MAX) {
+    params->points[n][0] = strtof(arg, &end);
+    if (end == arg || *end != '=')
+      return -EINVAL;
+    arg = end + 1;
+    params->points[n][1] = strtof(arg, &end);
+    if (end == arg || (*end && *end != ',') || params->points[n][1] < 0)
+      return -EINVAL;
+    if (n && params->points[n][0] <= params->points[n - 1][0])
+      return -EINVAL;
+    n++;
+    arg = *end ? end + 1 : end;
+  }
+  if (!n || *arg)
+    return -EINVAL;
+
+  params->profile = MOUSE_ACCEL_CUSTOM;
+  params->num_points = n;
+  return 0;
+}
+
+static const int pad_codes[MOUSE_PAD_AXES] = {
+  [MOUSE_PAD_X] = ABS_X,
+  [MOUSE_PAD_Y] = ABS_Y,
+  [MOUSE_PAD_Z] = ABS_Z,
+  [MOUSE_PAD_RX] = ABS_RX,
+  [MOUSE_PAD_RY] = ABS_RY,
+  [MOUSE_PAD_RZ] = ABS_RZ,
+  [MOUSE_PAD_HAT0X] = ABS_HAT0X,
+  [MOUSE_PAD_HAT0Y] = ABS_HAT0Y,
+};
+
+/* set a gamepad axis by its ABS_* code, other codes are ignored */
+void mouse_pad_set(struct mouse_pad *pad, int code, int value)
+{
+  unsigned int i;
+
+  for (i = 0; i < MOUSE_PAD_AXES; i++) {
+    if (pad_codes[i] == code) {
+      pad->value[i] = value;
+      return;
+    }
+  }
+}
+
+void mouse_pad_flush(struct mouse_pad *pad, struct mouse_frame *frame)
+{
+  unsigned int i;
+
+  for (i = 0; i < MOUSE_PAD_AXES; i++) {
+    if (pad->value[i] != pad->sent[i]) {
+      mouse_frame_add(frame, EV_ABS, pad_codes[i], pad->value[i]);
+      pad->sent[i] = pad->value[i];
+    }
+  }
+}
+
+void mouse_motion_add(struct mouse_motion *motion, float dx, float dy)
+{
+  motion->x += dx;
+  motion->y += dy;
+}
+
+/*
+ * Move the pointer by the whole pixels accumulated since the last flush,
+ * scaled by the gain for the current pointer speed. The speed is the motion
+ * since the last flush over the time since then. The sub-pixel remainder is
+ * carried over, so with unity gain the total motion sent matches the total
+ * motion added.
+ */
+void mouse_motion_flush(struct mouse_motion *motion,
+                        struct mouse_frame *frame)
+{
+  struct timespec ts;
+  double now, dt;
+  float gain = 1;
+  int x, y;
+
+  if (motion->accel) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec + ts.tv_nsec * 1e-9;
+    dt = now - motion->last;
+    if (dt < MOUSE_ACCEL_DT_MIN)
+      dt = MOUSE_ACCEL_DT_MIN;
+    else if (dt > MOUSE_ACCEL_DT_MAX)
+      dt = MOUSE_ACCEL_DT_MAX;
+    motion->last = now;
+    gain = mouse_accel_gain(motion->accel,
+                            sqrtf(motion->x * motion->x +
+                                  motion->y * motion->y) / dt);
+  }
+
+  motion->rx += gain * motion->x;
+  motion->ry += gain * motion->y;
+  motion->x = motion->y = 0;
+  x = motion->rx;
+  y = motion->ry;
+  mouse_frame_rel(frame, x, y);
+  motion->rx -= x;
+  motion->ry -= y;
+}
+
+void mouse_scroll_add(struct mouse_scroll *scroll, float wheel, float hwheel)
+{
+  scroll->wheel += wheel;
+  scroll->hwheel += hwheel;
+}
+
+static void scroll_axis(struct mouse_frame *frame, int code, int hi_res_code,
+                        float *acc, int *hi_res)
 {
-  struct input_event event, event_end;
-  memset(&event, 0, sizeof(event));
-  memset(&event_end, 0, sizeof(event_end));
+  int units = *acc, detents;
+
+  if (!units)
+    return;
+  *acc -= units;
+  mouse_frame_add(frame, EV_REL, hi_res_code, units);
+  *hi_res += units;
+  detents = *hi_res / MOUSE_WHEEL_HI_RES;
+  if (detents) {
+    mouse_frame_add(frame, EV_REL, code, detents);
+    *hi_res -= detents * MOUSE_WHEEL_HI_RES;
+  }
+}
 
-  gettimeofday(&event.time, NULL);
-  event.type = type;
-  event.code = code;
-  event.value = value;
-  gettimeofday(&event_end.time, NULL);
-  event_end.type = EV_SYN;
-  event_end.code = SYN_REPORT;
-  event_end.value = 0;
+void mouse_scroll_flush(struct mouse_scroll *scroll,
+                        struct mouse_frame *frame)
+{
+  scroll_axis(frame, REL_WHEEL, REL_WHEEL_HI_RES, &scroll->wheel,
+              &scroll->wheel_hi_res);
+  scroll_axis(frame, REL_HWHEEL, REL_HWHEEL_HI_RES, &scroll->hwheel,
+              &scroll->hwheel_hi_res);
+}
 
-  write(fd, &event, sizeof(event));// Move the mouse
-  write(fd, &event_end, sizeof(event_end));// Show move
+static void send_event(int fd, int type, int code, int value)
+{
+  struct mouse_frame frame;
 
+  mouse_frame_init(&frame, fd);
+  mouse_frame_add(&frame, type, code, value);
+  mouse_frame_flush(&frame);
 }
 
 void mouse_send_wheel(int fd, int value)
 {
-  send_event(fd, EV_REL, REL_WHEEL, value);
+  struct mouse_frame frame;
+
+  mouse_frame_init(&frame, fd);
+  mouse_frame_wheel(&frame, REL_WHEEL, value);
+  mouse_frame_flush(&frame);
 }
 
 void mouse_send_lmb(int fd, int value)
@@ -47,32 +355,140 @@ void mouse_send_lmb(int fd, int value)
 
 void mouse_move_relative(int fd, int x, int y)
 {
-  struct input_event event_x, event_y, event_end;
-  memset(&event_x, 0, sizeof(event_x));
-  memset(&event_y, 0, sizeof(event_y));
-  memset(&event_end, 0, sizeof(event_end));
+  struct mouse_frame frame;
+
+  mouse_frame_init(&frame, fd);
+  mouse_frame_rel(&frame, x, y);
+  mouse_frame_flush(&frame);
+}
+
+void mouse_frame_wheel(struct mouse_frame *frame, int code, int value)
+{
+  mouse_frame_add(frame, EV_REL, code, value);
+  mouse_frame_add(frame, EV_REL, code == REL_HWHEEL ? REL_HWHEEL_HI_RES :
+                  REL_WHEEL_HI_RES, value * MOUSE_WHEEL_HI_RES);
+}
 
-  gettimeofday(&event_x.time, NULL);
-  event_x.type = EV_REL;
-  event_x.code = REL_X;
-  event_x.value = x;
-  gettimeofday(&event_y.time, NULL);
-  event_y.type = EV_REL;
-  event_y.code = REL_Y;
-  event_y.value = y;
-  gettimeofday(&event_end.time, NULL);
-  event_end.type = EV_SYN;
-  event_end.code = SYN_REPORT;
-  event_end.value = 0;
+/* uinput device creation */
 
-  write(fd, &event_x, sizeof(event_x));// Move the mouse
-  write(fd, &event_y, sizeof(event_y));// Move the mouse
-  write(fd, &event_end, sizeof(event_end));// Show move
+static int set_bits(int fd, unsigned long req, const int *codes)
+{
+  for (; codes && *codes >= 0; codes++) {
+    if (ioctl(fd, req, *codes) < 0)
+      return -errno;
+  }
+  return 0;
 }
 
-int mouse_init(const char *device)
+int mouse_create_device(const struct mouse_device_desc *desc)
 {
-   int fd = open(device, O_RDWR);
+  struct uinput_setup setup;
+  struct uinput_abs_setup abs;
+  const struct mouse_abs_axis *axis;
+  const char *use = getenv("WIIREMOTE_UINPUT");
+  int fd, ret = 0;
+
+  /* WIIREMOTE_UINPUT=0 keeps benchmarks and tests off the real pointer */
+  if (use && !strcmp(use, "0"))
+    return -ENODEV;
+
+  fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    fd = open("/dev/input/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+
+  if (desc->keys && ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0)
+    ret = -errno;
+  if (!ret && desc->rels && ioctl(fd, UI_SET_EVBIT, EV_REL) < 0)
+    ret = -errno;
+  if (!ret && desc->abs && ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0)
+    ret = -errno;
+  if (!ret)
+    ret = set_bits(fd, UI_SET_KEYBIT, desc->keys);
+  if (!ret)
+    ret = set_bits(fd, UI_SET_RELBIT, desc->rels);
+  if (!ret)
+    ret = set_bits(fd, UI_SET_PROPBIT, desc->props);
+
+  for (axis = desc->abs; !ret && axis && axis->code >= 0; axis++) {
+    memset(&abs, 0, sizeof(abs));
+    abs.code = axis->code;
+    abs.absinfo.minimum = axis->min;
+    abs.absinfo.maximum = axis->max;
+    abs.absinfo.fuzz = axis->fuzz;
+    abs.absinfo.flat = axis->flat;
+    abs.absinfo.resolution = axis->resolution;
+    if (ioctl(fd, UI_SET_ABSBIT, axis->code) < 0 ||
+        ioctl(fd, UI_ABS_SETUP, &abs) < 0)
+      ret = -errno;
+  }
+
+  if (!ret) {
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = desc->vendor;
+    setup.id.product = desc->product;
+    setup.id.version = 1;
+    strncpy(setup.name, desc->name, UINPUT_MAX_NAME_SIZE - 1);
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 ||
+        ioctl(fd, UI_DEV_CREATE) < 0)
+      ret = -errno;
+  }
+
+  if (ret) {
+    close(fd);
+    return ret;
+  }
+  return fd;
+}
+
+/* relative pointer: the mouse buttons, key bindings add their keys */
+
+static const int pointer_keys[] = {
+  BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_SIDE, BTN_EXTRA, -1,
+};
+
+static const int pointer_rels[] = {
+  REL_X, REL_Y, REL_WHEEL, REL_HWHEEL,
+  REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES, -1,
+};
+
+/*
+ * Create a dedicated uinput pointer called @name. If uinput is not
+ * available, fall back to injecting into an existing event node given by
+ * @device (may be NULL). @keys adds EV_KEY codes to the mouse buttons,
+ * -1 terminated or NULL, e.g. keyboard keys sent by key bindings.
+ */
+int mouse_init(const char *device, const char *name, const int *keys)
+{
+  int all[MOUSE_KEYS_MAX + 1];
+  const struct mouse_device_desc desc = {
+    .name = name,
+    .vendor = MOUSE_VENDOR,
+    .product = MOUSE_PRODUCT_POINTER,
+    .keys = all,
+    .rels = pointer_rels,
+  };
+  unsigned int n = 0, i;
+  int fd;
+
+  for (i = 0; pointer_keys[i] >= 0; i++)
+    all[n++] = pointer_keys[i];
+  for (i = 0; keys && keys[i] >= 0 && n < MOUSE_KEYS_MAX; i++)
+    all[n++] = keys[i];
+  all[n] = -1;
+
+  fd = mouse_create_device(&desc);
+  if (fd >= 0)
+    return fd;
+
+  if (!device) {
+    printf("Error create uinput mouse:%s\n", strerror(-fd));
+    exit(EXIT_FAILURE);
+  }
+
+  fd = open(device, O_RDWR);
   if (fd < 0) {
     printf("Error open mouse:%s\n", strerror(errno));
     exit(EXIT_FAILURE);
@@ -80,13 +496,72 @@ int mouse_init(const char *device)
   return fd;
 }
 
+/*
+ * Absolute pointer for IR pointing, shaped like a virtual tablet: the
+ * buttons are only declared so udev classifies it as a mouse.
+ */
+int mouse_init_absolute(int max, const char *name)
+{
+  const struct mouse_abs_axis axes[] = {
+    { .code = ABS_X, .max = max },
+    { .code = ABS_Y, .max = max },
+    { .code = -1 },
+  };
+  const struct mouse_device_desc desc = {
+    .name = name,
+    .vendor = MOUSE_VENDOR,
+    .product = MOUSE_PRODUCT_ABSOLUTE,
+    .keys = pointer_keys,
+    .abs = axes,
+  };
+
+  return mouse_create_device(&desc);
+}
+
+/*
+ * Gamepad in the usual layout: two sticks on ABS_X/Y and ABS_RX/RY,
+ * triggers on ABS_Z/RZ, the D-pad as a hat and the face, shoulder and menu
+ * buttons. Axes have no flat zone, dead zones are applied before.
+ */
+int mouse_init_gamepad(const char *name)
+{
+  static const int keys[] = {
+    BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL, BTN_TR, BTN_TL2,
+    BTN_TR2, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR, -1,
+  };
+  const struct mouse_abs_axis axes[] = {
+    { .code = ABS_X, .min = -MOUSE_STICK_MAX, .max = MOUSE_STICK_MAX },
+    { .code = ABS_Y, .min = -MOUSE_STICK_MAX, .max = MOUSE_STICK_MAX },
+    { .code = ABS_RX, .min = -MOUSE_STICK_MAX, .max = MOUSE_STICK_MAX },
+    { .code = ABS_RY, .min = -MOUSE_STICK_MAX, .max = MOUSE_STICK_MAX },
+    { .code = ABS_Z, .max = MOUSE_TRIGGER_MAX },
+    { .code = ABS_RZ, .max = MOUSE_TRIGGER_MAX },
+    { .code = ABS_HAT0X, .min = -1, .max = 1 },
+    { .code = ABS_HAT0Y, .min = -1, .max = 1 },
+    { .code = -1 },
+  };
+  const struct mouse_device_desc desc = {
+    .name = name,
+    .vendor = MOUSE_VENDOR,
+    .product = MOUSE_PRODUCT_GAMEPAD,
+    .keys = keys,
+    .abs = axes,
+  };
+
+  return mouse_create_device(&desc);
+}
+
 void mouse_close(int fd)
 {
+  if (fd < 0)
+    return;
+  /* fails harmlessly with ENOTTY on a plain event node */
+  ioctl(fd, UI_DEV_DESTROY);
   close(fd);
 }
 #ifdef TEST_MOUSE
-int main(void) {
-  int fd = mouse_init("/dev/input/event6");
+int main(int argc, char **argv) {
+  int fd = mouse_init(argc > 1 ? argv[1] : NULL, "wiiremote test pointer", NULL);
   for (int i=0; i<5; i++) {
    mouse_move_relative(fd, 100, 100);
    sleep(1);// wait
@@ -1,7 +1,151 @@
 #ifndef __WII_MOUSE_H__
 #define __WII_MOUSE_H__ 1
 
-int mouse_init(const char *device);
+#include <linux/input.h>
+
+/* maximum number of events (including the trailing SYN_REPORT) per frame */
+#define MOUSE_FRAME_MAX 64
+
+/* EV_KEY codes of the relative pointer, buttons included */
+#define MOUSE_KEYS_MAX 128
+
+/* REL_WHEEL_HI_RES units per wheel detent */
+#define MOUSE_WHEEL_HI_RES 120
+
+/* entries of a pointer acceleration table, and of a custom profile */
+#define MOUSE_ACCEL_TABLE 256
+#define MOUSE_ACCEL_POINTS_MAX 8
+
+/* ids of the virtual devices we create (bus is always BUS_VIRTUAL) */
+#define MOUSE_VENDOR 0x0000
+#define MOUSE_PRODUCT_POINTER 0x0001
+#define MOUSE_PRODUCT_ABSOLUTE 0x0002
+#define MOUSE_PRODUCT_GAMEPAD 0x0003
+
+/* gamepad axis ranges: sticks are centred on 0, triggers rest at 0 */
+#define MOUSE_STICK_MAX 32767
+#define MOUSE_TRIGGER_MAX 255
+
+/* absolute axis of a uinput device */
+struct mouse_abs_axis {
+  int code;
+  int min, max, fuzz, flat, resolution;
+};
+
+/*
+ * Capabilities of a uinput device. Code lists are terminated by -1, the
+ * axis list by an entry with code -1. Unused lists are NULL.
+ */
+struct mouse_device_desc {
+  const char *name;
+  unsigned short vendor, product;
+  const int *keys;
+  const int *rels;
+  const int *props;
+  const struct mouse_abs_axis *abs;
+};
+
+/*
+ * Event frame: collects any number of input events and writes them out
+ * together with a single SYN_REPORT in one write() call.
+ */
+struct mouse_frame {
+  int fd;
+  unsigned int num;
+  struct input_event ev[MOUSE_FRAME_MAX];
+};
+
+enum mouse_accel_profile {
+  MOUSE_ACCEL_FLAT,
+  MOUSE_ACCEL_ADAPTIVE,
+  MOUSE_ACCEL_CUSTOM,
+};
+
+/*
+ * Pointer ballistics: gain as a function of the pointer speed in pixels per
+ * second. Flat is a constant gain. Adaptive keeps unity gain up to
+ * threshold, then rises linearly to max_gain at max_speed, so slow moves stay
+ * precise and fast sweeps cover the screen. Custom interpolates between
+ * (speed, gain) points.
+ */
+struct mouse_accel_params {
+  enum mouse_accel_profile profile;
+  float gain;
+  float threshold, max_speed, max_gain;
+  unsigned int num_points;
+  float points[MOUSE_ACCEL_POINTS_MAX][2];
+};
+
+/* gain sampled at evenly spaced speeds, faster moves use the last entry */
+struct mouse_accel {
+  float step_inv;
+  float gain[MOUSE_ACCEL_TABLE];
+};
+
+/* the axes of the gamepad from mouse_init_gamepad() */
+enum mouse_pad_axis {
+  MOUSE_PAD_X,
+  MOUSE_PAD_Y,
+  MOUSE_PAD_Z,
+  MOUSE_PAD_RX,
+  MOUSE_PAD_RY,
+  MOUSE_PAD_RZ,
+  MOUSE_PAD_HAT0X,
+  MOUSE_PAD_HAT0Y,
+  MOUSE_PAD_AXES,
+};
+
+/*
+ * Gamepad axis state. Any number of reports may set it between two
+ * flushes; a flush sends only the axes that changed since the last one.
+ */
+struct mouse_pad {
+  int value[MOUSE_PAD_AXES];
+  int sent[MOUSE_PAD_AXES];
+};
+
+/*
+ * Pointer motion accumulated between two output frames, in pixels before
+ * gain. The remainder is what is left after gain and rounding to pixels.
+ */
+struct mouse_motion {
+  float x, y;
+  float rx, ry;
+  const struct mouse_accel *accel;
+  double last;
+};
+
+/*
+ * Smooth scrolling accumulated between two output frames, in
+ * REL_WHEEL_HI_RES units. Fractions carry over to the next flush, and so
+ * do hi-res units short of a whole detent for the legacy wheel events.
+ */
+struct mouse_scroll {
+  float wheel, hwheel;
+  int wheel_hi_res, hwheel_hi_res;
+};
+
+int mouse_create_device(const struct mouse_device_desc *desc);
+int mouse_init(const char *device, const char *name, const int *keys);
+int mouse_init_absolute(int max, const char *name);
+int mouse_init_gamepad(const char *name);
+void mouse_frame_init(struct mouse_frame *frame, int fd);
+void mouse_frame_add(struct mouse_frame *frame, int type, int code, int value);
+void mouse_frame_rel(struct mouse_frame *frame, int x, int y);
+void mouse_frame_wheel(struct mouse_frame *frame, int code, int value);
+int mouse_frame_flush(struct mouse_frame *frame);
+void mouse_accel_build(struct mouse_accel *accel,
+                       const struct mouse_accel_params *params);
+float mouse_accel_gain(const struct mouse_accel *accel, float speed);
+int mouse_accel_parse(struct mouse_accel_params *params, const char *spec);
+void mouse_pad_set(struct mouse_pad *pad, int code, int value);
+void mouse_pad_flush(struct mouse_pad *pad, struct mouse_frame *frame);
+void mouse_motion_add(struct mouse_motion *motion, float dx, float dy);
+void mouse_motion_flush(struct mouse_motion *motion,
+                        struct mouse_frame *frame);
+void mouse_scroll_add(struct mouse_scroll *scroll, float wheel, float hwheel);
+void mouse_scroll_flush(struct mouse_scroll *scroll,
+                        struct mouse_frame *frame);
 void mouse_send_lmb(int fd, int value);
 void mouse_send_wheel(int fd, int value);
 void mouse_move_relative(int fd, int x, int y);
@@ -0,0 +1,200 @@
+/*
+ * MotionPlus bias calibration
+ *
+ * The gyro bias drifts with temperature, so instead of a one-shot
+ * calibration the bias is re-estimated whenever the remote lies still:
+ * a window of MPCAL_WINDOW samples with low variance on all three axes and
+ * no change on the accelerometer is taken as "at rest" and its mean is added
+ * to the normalization offsets. Everything is incremental, a sample costs a
+ * few additions.
+ *
+ * Learned offsets are stored per device (keyed by the HID_UNIQ bluetooth
+ * address) so a restart does not need a new calibration pass.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "mpcal.h"
+
+/* samples per still window, about one second */
+#define MPCAL_WINDOW 128
+/* a single residual above this means the remote is turning */
+#define MPCAL_MOVING 400
+/* maximum per-axis variance of a still window */
+#define MPCAL_VARIANCE 900
+/* accelerometer change (per report) that counts as motion */
+#define MPCAL_ACCEL_DELTA 6
+
+#define MPCAL_DEFAULT_DIR "/var/lib/wiiremote"
+
+static void mp_calib_restart(struct mp_calib *cal)
+{
+  cal->num = 0;
+  memset(cal->sum, 0, sizeof(cal->sum));
+  memset(cal->sumsq, 0, sizeof(cal->sumsq));
+  cal->accel_moved = false;
+}
+
+void mp_calib_init(struct mp_calib *cal)
+{
+  memset(cal, 0, sizeof(*cal));
+}
+
+void mp_calib_accel(struct mp_calib *cal, const struct xwii_event_abs *accel)
+{
+  if (abs(accel->x - cal->accel[0]) > MPCAL_ACCEL_DELTA ||
+      abs(accel->y - cal->accel[1]) > MPCAL_ACCEL_DELTA ||
+      abs(accel->z - cal->accel[2]) > MPCAL_ACCEL_DELTA)
+    cal->accel_moved = true;
+
+  cal->accel[0] = accel->x;
+  cal->accel[1] = accel->y;
+  cal->accel[2] = accel->z;
+}
+
+/*
+ * Feed a normalized MotionPlus sample. Returns true if cal->norm was updated
+ * and has to be applied to the interface.
+ */
+bool mp_calib_sample(struct mp_calib *cal, const struct xwii_event_abs *rate)
+{
+  const int32_t v[3] = { rate->x, rate->y, rate->z };
+  int64_t mean, var;
+  bool changed = false;
+  int i;
+
+  if (cal->accel_moved) {
+    mp_calib_restart(cal);
+    return false;
+  }
+
+  for (i = 0; i < 3; i++) {
+    if (abs(v[i]) > MPCAL_MOVING) {
+      mp_calib_restart(cal);
+      return false;
+    }
+    cal->sum[i] += v[i];
+    cal->sumsq[i] += (int64_t)v[i] * v[i];
+  }
+
+  if (++cal->num < MPCAL_WINDOW)
+    return false;
+
+  for (i = 0; i < 3; i++) {
+    var = (cal->sumsq[i] - cal->sum[i] * cal->sum[i] / MPCAL_WINDOW) /
+          MPCAL_WINDOW;
+    if (var > MPCAL_VARIANCE) {
+      mp_calib_restart(cal);
+      return false;
+    }
+  }
+
+  for (i = 0; i < 3; i++) {
+    mean = cal->sum[i] / MPCAL_WINDOW;
+    if (mean) {
+      cal->norm[i] += mean;
+      changed = true;
+    }
+  }
+
+  cal->dirty |= changed;
+  mp_calib_restart(cal);
+  return changed;
+}
+
+/* stable identifier of a remote: its bluetooth address from HID_UNIQ */
+int mp_calib_device_id(const char *syspath, char *id, size_t size)
+{
+  char path[512], line[128];
+  FILE *f;
+  int ret = -ENOENT;
+  size_t i;
+
+  snprintf(path, sizeof(path), "%s/uevent", syspath);
+  f = fopen(path, "re");
+  if (!f)
+    return -errno;
+
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "HID_UNIQ=", 9) || line[9] == '\n')
+      continue;
+    snprintf(id, size, "%s", line + 9);
+    for (i = 0; id[i]; i++) {
+      if (id[i] == '\n')
+        id[i] = 0;
+      else if (id[i] == ':' || id[i] == '/')
+        id[i] = '-';
+    }
+    ret = 0;
+    break;
+  }
+
+  fclose(f);
+  return ret;
+}
+
+static const char *mp_calib_dir(void)
+{
+  const char *dir = getenv("WIIREMOTE_STATE_DIR");
+
+  return dir ? dir : MPCAL_DEFAULT_DIR;
+}
+
+static void mp_calib_path(char *path, size_t size, const char *id)
+{
+  snprintf(path, size, "%s/mp-%s.cal", mp_calib_dir(), id);
+}
+
+int mp_calib_load(struct mp_calib *cal, const char *id)
+{
+  char path[512];
+  int32_t x, y, z;
+  FILE *f;
+  int ret = 0;
+
+  mp_calib_path(path, sizeof(path), id);
+  f = fopen(path, "re");
+  if (!f)
+    return -errno;
+
+  if (fscanf(f, "%" SCNd32 " %" SCNd32 " %" SCNd32, &x, &y, &z) == 3) {
+    cal->norm[0] = x;
+    cal->norm[1] = y;
+    cal->norm[2] = z;
+    cal->dirty = false;
+  } else {
+    ret = -EINVAL;
+  }
+
+  fclose(f);
+  return ret;
+}
+
+int mp_calib_save(struct mp_calib *cal, const char *id)
+{
+  char path[512], tmp[520];
+  FILE *f;
+
+  if (!cal->dirty)
+    return 0;
+
+  mkdir(mp_calib_dir(), 0755);
+  mp_calib_path(path, sizeof(path), id);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  f = fopen(tmp, "we");
+  if (!f)
+    return -errno;
+  fprintf(f, "%" PRId32 " %" PRId32 " %" PRId32 "\n",
+          cal->norm[0], cal->norm[1], cal->norm[2]);
+  if (fclose(f) || rename(tmp, path))
+    return -errno;
+
+  cal->dirty = false;
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __WII_MPCAL_H__
+#define __WII_MPCAL_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "xwiimote.h"
+
+/*
+ * Background MotionPlus bias estimator. Samples are collected while the
+ * remote is at rest; the mean of a still window is the remaining gyro bias
+ * and is folded into the normalization offsets.
+ */
+struct mp_calib {
+  /* normalization offsets as last handed to xwii_iface_set_mp_normalization() */
+  int32_t norm[3];
+  /* current still window */
+  unsigned int num;
+  int64_t sum[3];
+  int64_t sumsq[3];
+  /* accelerometer reading to detect motion the gyro does not see */
+  int32_t accel[3];
+  bool accel_moved;
+  /* offsets changed since loading/saving */
+  bool dirty;
+};
+
+void mp_calib_init(struct mp_calib *cal);
+void mp_calib_accel(struct mp_calib *cal, const struct xwii_event_abs *accel);
+bool mp_calib_sample(struct mp_calib *cal, const struct xwii_event_abs *rate);
+int mp_calib_device_id(const char *syspath, char *id, size_t size);
+int mp_calib_load(struct mp_calib *cal, const char *id);
+int mp_calib_save(struct mp_calib *cal, const char *id);
+
+#endif /* __WII_MPCAL_H__ */
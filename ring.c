@@ -0,0 +1,56 @@
+/*
+ * Lock-free single-producer/single-consumer event ring
+ *
+ * The producer publishes an entry with a release store of head after
+ * copying it in; the consumer acquires head before reading the entry and
+ * hands the slot back with a release store of tail.
+ */
+#include <string.h>
+
+#include "ring.h"
+
+void ring_init(struct ring *ring)
+{
+  memset(ring, 0, sizeof(*ring));
+}
+
+bool ring_push(struct ring *ring, const struct ring_entry *entry)
+{
+  unsigned int head, tail, depth;
+
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+    return false;
+  }
+
+  ring->entries[head & (RING_SIZE - 1)] = *entry;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+  depth = head + 1 - tail;
+  if (depth > atomic_load_explicit(&ring->high_water, memory_order_relaxed))
+    atomic_store_explicit(&ring->high_water, depth, memory_order_relaxed);
+  return true;
+}
+
+bool ring_pop(struct ring *ring, struct ring_entry *entry)
+{
+  unsigned int head, tail;
+
+  tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  *entry = ring->entries[tail & (RING_SIZE - 1)];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+unsigned int ring_depth(struct ring *ring)
+{
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,46 @@
+#ifndef __WII_RING_H__
+#define __WII_RING_H__ 1
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "xwiimote.h"
+
+/* number of queued events, must be a power of two */
+#define RING_SIZE 1024
+
+struct ring_entry {
+  unsigned int dev;
+  /* latency_now() when the reader got the event */
+  uint64_t dispatched;
+  struct xwii_event event;
+};
+
+/*
+ * Fixed-size single-producer/single-consumer event queue. The producer only
+ * writes head, the consumer only writes tail, so neither side takes a lock.
+ * Both indices run freely and are masked on access.
+ */
+struct ring {
+  _Atomic unsigned int head;
+  /* keep the indices on separate cache lines */
+  char pad0[64 - sizeof(unsigned int)];
+  _Atomic unsigned int tail;
+  char pad1[64 - sizeof(unsigned int)];
+
+  /* producer side statistics */
+  _Atomic uint64_t pushed;
+  _Atomic uint64_t overflows;
+  _Atomic unsigned int high_water;
+
+  struct ring_entry entries[RING_SIZE];
+};
+
+void ring_init(struct ring *ring);
+/* producer: false and counted as overflow if the ring is full */
+bool ring_push(struct ring *ring, const struct ring_entry *entry);
+/* consumer: false if the ring is empty */
+bool ring_pop(struct ring *ring, struct ring_entry *entry);
+unsigned int ring_depth(struct ring *ring);
+
+#endif /* __WII_RING_H__ */
@@ -0,0 +1,347 @@
+/*
+ * Unit tests
+ *
+ * Checks of the parsers and table builders that need no remote or uinput:
+ * config files, key bindings, response curves and pointer ballistics. Run
+ * by "make test"; prints each failed check and exits non-zero if any did.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "bind.h"
+#include "config.h"
+#include "curve.h"
+#include "mouse.h"
+
+static unsigned int test_checks, test_failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    test_checks++;                                                      \
+    if (!(cond)) {                                                      \
+      test_failures++;                                                  \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);            \
+    }                                                                   \
+  } while (0)
+
+static const char *const test_modes[] = { "normal", "nfs", "ir", "gyro" };
+#define TEST_MODES 4
+
+/* large tables, kept out of the stack */
+static struct config test_config;
+static struct curve test_curve;
+
+static void test_config_reset(struct config *config)
+{
+  memset(config, 0, sizeof(*config));
+  bind_init(&config->bindings);
+  config->steer_range = 60;
+  config->steer_dead_zone = 2;
+  config->steer_params.type = CURVE_POWER;
+  config->steer_params.exponent = 1;
+  config->stick_params.type = CURVE_POWER;
+  config->stick_params.exponent = 1;
+  config->wasd_threshold = 0.5f;
+}
+
+/* reset config and load text into it, *line is the line of an error */
+static int test_load(struct config *config, const char *text,
+                     unsigned int *line)
+{
+  FILE *file;
+  int ret;
+
+  test_config_reset(config);
+  file = fmemopen((void *)text, strlen(text), "r");
+  if (!file)
+    return -errno;
+  ret = config_load(config, file, test_modes, TEST_MODES, line);
+  fclose(file);
+  return ret;
+}
+
+static bool has_code(const struct bind_table *table, int code)
+{
+  const int *c;
+
+  for (c = table->codes; *c >= 0; c++)
+    if (*c == code)
+      return true;
+  return false;
+}
+
+static void test_config_load(void)
+{
+  struct config *c = &test_config;
+  unsigned int line;
+
+  /* lines before a section apply to all modes, later lines override */
+  CHECK(!test_load(c, "a = button left\n"
+                      "[gyro ir]\n"
+                      "a = button right\n"
+                      "# comment\n"
+                      "\n"
+                      "[ir]\n"
+                      "a = key space  # trailing comment\n", &line));
+  CHECK(c->bindings.keys[0][XWII_KEY_A].type == BIND_KEY);
+  CHECK(c->bindings.keys[0][XWII_KEY_A].code == BTN_LEFT);
+  CHECK(c->bindings.keys[1][XWII_KEY_A].code == BTN_LEFT);
+  CHECK(c->bindings.keys[3][XWII_KEY_A].code == BTN_RIGHT);
+  CHECK(c->bindings.keys[2][XWII_KEY_A].code == KEY_SPACE);
+  CHECK(has_code(&c->bindings, BTN_LEFT));
+  CHECK(has_code(&c->bindings, KEY_SPACE));
+  CHECK(!has_code(&c->bindings, KEY_ENTER));
+
+  /* per-mode options follow the section, global ones ignore it */
+  CHECK(!test_load(c, "[gyro]\n"
+                      "filter_beta = 0.5\n"
+                      "gyro_speed = 1234\n"
+                      "pointer_accel = flat:2\n"
+                      "nunchuk = wasd\n", &line));
+  CHECK(c->filter[3].beta == 0.5f && c->filter[0].beta == 0);
+  CHECK(c->gyro.speed == 1234);
+  CHECK(c->accel_params[3].profile == MOUSE_ACCEL_FLAT);
+  CHECK(c->accel_params[3].gain == 2 && c->accel_params[0].gain == 0);
+  CHECK(c->stick[3] == CONFIG_STICK_WASD && c->stick[0] == CONFIG_STICK_OFF);
+  CHECK(has_code(&c->bindings, KEY_W) && has_code(&c->bindings, KEY_D));
+
+  /* errors name their line */
+  CHECK(test_load(c, "a = button left\n\nb = frobnicate\n", &line) ==
+        -EINVAL);
+  CHECK(line == 3);
+  CHECK(test_load(c, "[normal]\n[turbo]\n", &line) == -EINVAL);
+  CHECK(line == 2);
+  CHECK(test_load(c, "[normal\n", &line) == -EINVAL);
+  CHECK(line == 1);
+  CHECK(test_load(c, "no_equals_sign\n", &line) == -EINVAL);
+  CHECK(test_load(c, "unknown_option = 1\n", &line) == -EINVAL);
+  CHECK(test_load(c, "gyro_speed = 0\n", &line) == -EINVAL);
+  CHECK(test_load(c, "gyro_speed = fast\n", &line) == -EINVAL);
+  CHECK(test_load(c, "nunchuk = joystick\n", &line) == -EINVAL);
+
+  /* checks across options run at the end */
+  CHECK(test_load(c, "steer_range = 10\nsteer_dead_zone = 10\n", &line) ==
+        -EINVAL);
+  CHECK(test_load(c, "stick_dead_zone_x = 100\n", &line) == -EINVAL);
+  CHECK(test_load(c, "wasd_threshold = 1.5\n", &line) == -EINVAL);
+  CHECK(test_load(c, "steer_range = 200\n", &line) == -EINVAL);
+}
+
+static void test_config_build(void)
+{
+  struct config *c = &test_config;
+  unsigned int line;
+
+  CHECK(!test_load(c, "steer_range = 30\nsteer_dead_zone = 0\n", &line));
+  CHECK(!config_build(c));
+  CHECK(curve_apply(&c->steer, 30 * CONFIG_STEER_UNITS) == MOUSE_STICK_MAX);
+  CHECK(curve_apply(&c->steer, -30 * CONFIG_STEER_UNITS) == -MOUSE_STICK_MAX);
+  CHECK(curve_apply(&c->stick_curve[0], CONFIG_STICK_RANGE) == 1);
+
+  /* ranges too small for a table pass the parser but not the build */
+  CHECK(!test_load(c, "steer_range = 0.05\nsteer_dead_zone = 0\n", &line));
+  CHECK(config_build(c) == -EINVAL);
+  CHECK(!test_load(c, "stick_dead_zone_x = 99.6\n", &line));
+  CHECK(config_build(c) == -EINVAL);
+}
+
+static void test_bind(void)
+{
+  struct bind_table *t = &test_config.bindings;
+  char args[256];
+  unsigned int mask, i;
+
+  bind_init(t);
+  strcpy(args, "normal, gyro");
+  CHECK(!bind_modes(args, test_modes, TEST_MODES, &mask) && mask == 0x9);
+  strcpy(args, "normal turbo");
+  CHECK(bind_modes(args, test_modes, TEST_MODES, &mask) == -EINVAL);
+  strcpy(args, " ");
+  CHECK(bind_modes(args, test_modes, TEST_MODES, &mask) == -EINVAL);
+
+  CHECK(bind_key("home") == XWII_KEY_HOME);
+  CHECK(bind_key("c") == XWII_KEY_C);
+  CHECK(bind_key("start") == -1);
+
+#define SET(key, text) \
+  (strcpy(args, (text)), bind_set(t, 1, (key), args, test_modes, TEST_MODES))
+
+  CHECK(!SET(XWII_KEY_UP, "wheel -3"));
+  CHECK(t->keys[0][XWII_KEY_UP].type == BIND_WHEEL);
+  CHECK(t->keys[0][XWII_KEY_UP].code == REL_WHEEL);
+  CHECK(t->keys[0][XWII_KEY_UP].value == -3);
+  CHECK(SET(XWII_KEY_UP, "wheel 0") == -EINVAL);
+  CHECK(SET(XWII_KEY_UP, "wheel 101") == -EINVAL);
+  CHECK(SET(XWII_KEY_UP, "hwheel 1 2") == -EINVAL);
+  CHECK(!SET(XWII_KEY_ONE, "mode gyro"));
+  CHECK(t->keys[0][XWII_KEY_ONE].type == BIND_MODE);
+  CHECK(t->keys[0][XWII_KEY_ONE].value == 3);
+  CHECK(SET(XWII_KEY_ONE, "mode turbo") == -EINVAL);
+  CHECK(!SET(XWII_KEY_TWO, "pedal gas"));
+  CHECK(t->keys[0][XWII_KEY_TWO].code == ABS_RZ);
+  CHECK(SET(XWII_KEY_TWO, "pad select") == 0);
+  CHECK(SET(XWII_KEY_TWO, "pad menu") == -EINVAL);
+  CHECK(!SET(XWII_KEY_B, "key 0x1e"));
+  CHECK(t->keys[0][XWII_KEY_B].code == KEY_A);
+  CHECK(SET(XWII_KEY_B, "key 0x0") == -EINVAL);
+  CHECK(SET(XWII_KEY_B, "key 99999") == -EINVAL);
+  CHECK(SET(XWII_KEY_B, "button leftish") == -EINVAL);
+  CHECK(SET(XWII_KEY_B, "clutch now") == -EINVAL);
+  CHECK(SET(XWII_KEY_NUM, "none") == -EINVAL);
+
+  /* chords end with a 0 step */
+  CHECK(!SET(XWII_KEY_HOME, "macro leftctrl+c space"));
+  i = t->keys[0][XWII_KEY_HOME].value;
+  CHECK(t->keys[0][XWII_KEY_HOME].type == BIND_MACRO);
+  CHECK(t->macros[i].num == 5);
+  CHECK(t->macros[i].steps[0] == KEY_LEFTCTRL && t->macros[i].steps[1] == KEY_C);
+  CHECK(t->macros[i].steps[2] == 0 && t->macros[i].steps[3] == KEY_SPACE);
+  CHECK(SET(XWII_KEY_HOME, "macro") == -EINVAL);
+  CHECK(SET(XWII_KEY_HOME, "macro nosuchkey") == -EINVAL);
+
+  /* a chord of BIND_MACRO_STEPS - 1 keys fits with its end, one more not */
+  strcpy(args, "macro a");
+  for (i = 1; i < BIND_MACRO_STEPS - 1; i++)
+    strcat(args, "+a");
+  CHECK(!bind_set(t, 1, XWII_KEY_HOME, args, test_modes, TEST_MODES));
+  strcpy(args, "macro a");
+  for (i = 1; i < BIND_MACRO_STEPS; i++)
+    strcat(args, "+a");
+  CHECK(bind_set(t, 1, XWII_KEY_HOME, args, test_modes, TEST_MODES) ==
+        -EINVAL);
+
+  /* the table holds BIND_MACRO_MAX macros */
+  bind_init(t);
+  for (i = 0; i < BIND_MACRO_MAX; i++)
+    CHECK(!SET(XWII_KEY_HOME, "macro a"));
+  CHECK(SET(XWII_KEY_HOME, "macro a") == -ENOSPC);
+
+  /* and BIND_CODES_MAX distinct key codes */
+  bind_init(t);
+  for (i = 0; i < BIND_CODES_MAX; i++) {
+    /* by number, "1" would be the 1 key */
+    snprintf(args, sizeof(args), "key 0x%x", KEY_ESC + i);
+    CHECK(!bind_set(t, 1, XWII_KEY_A, args, test_modes, TEST_MODES));
+  }
+  CHECK(t->codes[BIND_CODES_MAX] == -1);
+  snprintf(args, sizeof(args), "key 0x%x", KEY_ESC + BIND_CODES_MAX);
+  CHECK(bind_set(t, 1, XWII_KEY_A, args, test_modes, TEST_MODES) == -ENOSPC);
+  /* a code already in the table takes no room */
+  CHECK(!SET(XWII_KEY_A, "key esc"));
+#undef SET
+}
+
+static void test_curve_parse(void)
+{
+  struct curve_params p;
+
+  CHECK(!curve_parse(&p, "power:2") && p.type == CURVE_POWER &&
+        p.exponent == 2);
+  CHECK(!curve_parse(&p, "scurve:3") && p.type == CURVE_SCURVE);
+  CHECK(!curve_parse(&p, "piecewise:0.5=0.2,1=1") &&
+        p.type == CURVE_PIECEWISE && p.num_points == 2);
+  CHECK(curve_parse(&p, "power") == -EINVAL);
+  CHECK(curve_parse(&p, "power:") == -EINVAL);
+  CHECK(curve_parse(&p, "power:0") == -EINVAL);
+  CHECK(curve_parse(&p, "power:2x") == -EINVAL);
+  CHECK(curve_parse(&p, "cubic:2") == -EINVAL);
+  CHECK(curve_parse(&p, "piecewise:") == -EINVAL);
+  CHECK(curve_parse(&p, "piecewise:0.5") == -EINVAL);
+  CHECK(curve_parse(&p, "piecewise:0.5=0.2,0.4=1") == -EINVAL);
+  CHECK(curve_parse(&p, "piecewise:0.1=0,0.2=0,0.3=0,0.4=0,0.5=0,0.6=0,"
+                        "0.7=0,0.8=0,0.9=1") == -EINVAL);
+}
+
+static void test_curve_build(void)
+{
+  struct curve_params p = {
+    .type = CURVE_POWER, .range = 512, .scale = 10, .exponent = 2,
+  };
+  struct curve *c = &test_curve;
+  int32_t raw;
+  bool exact = true;
+
+  CHECK(!curve_build(c, &p, -512, 512, 0, false));
+  for (raw = -600; raw <= 600; raw++) {
+    if (fabsf(curve_apply(c, raw) -
+              curve_eval(&p, raw < -512 ? -512 : raw > 512 ? 512 : raw)) >
+        1e-4f)
+      exact = false;
+  }
+  CHECK(exact);
+
+  /* max on an entry: the interpolating table has its pair past max */
+  CHECK(!curve_build(c, &p, -512, 512, 3, true));
+  CHECK(c->num == 1024 / 8 + 2);
+  CHECK(fabsf(curve_apply(c, 512) - 10) < 1e-4f);
+  CHECK(fabsf(curve_apply(c, 1000) - 10) < 1e-4f);
+  CHECK(fabsf(curve_apply(c, -512) + 10) < 1e-4f);
+  CHECK(fabsf(curve_apply(c, 4) - curve_eval(&p, 4)) < 0.01f);
+
+  /* and max between entries */
+  CHECK(!curve_build(c, &p, -511, 511, 3, true));
+  CHECK(fabsf(curve_apply(c, 511) - curve_eval(&p, 511)) < 0.01f);
+
+  /* the largest tables */
+  CHECK(!curve_build(c, &p, 0, CURVE_TABLE_MAX - 1, 0, false));
+  CHECK(curve_build(c, &p, 0, CURVE_TABLE_MAX, 0, false) == -E2BIG);
+  CHECK(!curve_build(c, &p, 0, (CURVE_TABLE_MAX - 2) * 8, 3, true));
+  CHECK(c->num == CURVE_TABLE_MAX);
+  CHECK(curve_build(c, &p, 0, (CURVE_TABLE_MAX - 1) * 8, 3, true) == -E2BIG);
+
+  CHECK(curve_build(c, &p, 5, 5, 0, false) == -EINVAL);
+  CHECK(curve_build(c, &p, 0, 0, 0, false) == -EINVAL);
+}
+
+static void test_mouse_accel(void)
+{
+  struct mouse_accel_params p;
+  struct mouse_accel a;
+
+  CHECK(!mouse_accel_parse(&p, "flat:1.5") && p.profile == MOUSE_ACCEL_FLAT &&
+        p.gain == 1.5f);
+  /* threshold and max_speed default to 200 and 2000 */
+  CHECK(!mouse_accel_parse(&p, "adaptive:3") &&
+        p.profile == MOUSE_ACCEL_ADAPTIVE && p.max_gain == 3 &&
+        p.threshold == 200 &&
+        p.max_speed == 2000);
+  CHECK(!mouse_accel_parse(&p, "adaptive:3,100,900") && p.threshold == 100 &&
+        p.max_speed == 900);
+  CHECK(!mouse_accel_parse(&p, "custom:100=1,500=2") &&
+        p.profile == MOUSE_ACCEL_CUSTOM && p.num_points == 2);
+  CHECK(mouse_accel_parse(&p, "flat") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "flat:0") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "adaptive:3,900,100") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "adaptive:3,,") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "custom:") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "custom:500=1,100=2") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "custom:100=-1") == -EINVAL);
+  CHECK(mouse_accel_parse(&p, "turbo:2") == -EINVAL);
+
+  CHECK(!mouse_accel_parse(&p, "flat:2"));
+  mouse_accel_build(&a, &p);
+  CHECK(mouse_accel_gain(&a, 0) == 2 && mouse_accel_gain(&a, 1e6f) == 2);
+
+  CHECK(!mouse_accel_parse(&p, "adaptive:3,100,900"));
+  mouse_accel_build(&a, &p);
+  CHECK(fabsf(mouse_accel_gain(&a, 50) - 1) < 0.01f);
+  CHECK(fabsf(mouse_accel_gain(&a, 1e6f) - 3) < 0.01f);
+  CHECK(mouse_accel_gain(&a, 500) > 1 && mouse_accel_gain(&a, 500) < 3);
+}
+
+int main(void)
+{
+  test_config_load();
+  test_config_build();
+  test_bind();
+  test_curve_parse();
+  test_curve_build();
+  test_mouse_accel();
+
+  printf("%u checks, %u failed\n", test_checks, test_failures);
+  return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+ * Event traces for record and replay
+ *
+ * Recording goes through a buffered stream so the event loop only copies
+ * into memory; replay maps the whole file read-only.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER (64 * 1024)
+
+static void trace_header_init(struct trace_header *header)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->version = TRACE_VERSION;
+  header->record_size = sizeof(struct trace_record);
+}
+
+static int trace_header_check(const struct trace_header *header)
+{
+  if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)))
+    return -EINVAL;
+  if (header->version != TRACE_VERSION ||
+      header->record_size != sizeof(struct trace_record))
+    return -EPROTO;
+  return 0;
+}
+
+int trace_create(struct trace_writer *writer, const char *path)
+{
+  struct trace_header header;
+  struct stat st;
+  off_t end;
+  int fd, ret;
+
+  memset(writer, 0, sizeof(*writer));
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -errno;
+  if (fstat(fd, &st) < 0)
+    goto err_errno;
+
+  if (st.st_size < (off_t)sizeof(header)) {
+    /* new trace, or one that never got past its header */
+    trace_header_init(&header);
+    if (ftruncate(fd, 0) < 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+      goto err_errno;
+    end = sizeof(header);
+  } else {
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+      goto err_errno;
+    ret = trace_header_check(&header);
+    if (ret)
+      goto err;
+
+    /* drop a record torn by a crash so new ones stay aligned */
+    writer->num = (st.st_size - sizeof(header)) / sizeof(struct trace_record);
+    end = sizeof(header) + writer->num * sizeof(struct trace_record);
+    if (end != st.st_size && ftruncate(fd, end) < 0)
+      goto err_errno;
+  }
+
+  if (lseek(fd, end, SEEK_SET) < 0)
+    goto err_errno;
+
+  writer->file = fdopen(fd, "w");
+  if (!writer->file)
+    goto err_errno;
+  setvbuf(writer->file, NULL, _IOFBF, TRACE_BUFFER);
+  return 0;
+
+err_errno:
+  ret = -errno;
+err:
+  close(fd);
+  return ret;
+}
+
+int trace_write(struct trace_writer *writer, unsigned int dev,
+                const struct xwii_event *event)
+{
+  struct trace_record record;
+
+  memset(&record, 0, sizeof(record));
+  record.dev = dev;
+  record.event = *event;
+
+  if (fwrite(&record, sizeof(record), 1, writer->file) != 1)
+    return -EIO;
+
+  writer->num++;
+  return 0;
+}
+
+int trace_close(struct trace_writer *writer)
+{
+  int ret = 0;
+
+  if (!writer->file)
+    return 0;
+
+  if (fclose(writer->file))
+    ret = -errno;
+  writer->file = NULL;
+  return ret;
+}
+
+int trace_map(struct trace *trace, const char *path)
+{
+  const struct trace_header *header;
+  struct stat st;
+  int fd, ret;
+
+  memset(trace, 0, sizeof(*trace));
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -errno;
+  if (fstat(fd, &st) < 0) {
+    ret = -errno;
+    close(fd);
+    return ret;
+  }
+  if (st.st_size < (off_t)sizeof(*header)) {
+    close(fd);
+    return -EINVAL;
+  }
+
+  trace->size = st.st_size;
+  trace->map = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ret = -errno;
+  close(fd);
+  if (trace->map == MAP_FAILED) {
+    trace->map = NULL;
+    return ret;
+  }
+
+  header = trace->map;
+  ret = trace_header_check(header);
+  if (ret) {
+    trace_unmap(trace);
+    return ret;
+  }
+
+  /* records are read front to back exactly once */
+  madvise(trace->map, trace->size, MADV_SEQUENTIAL);
+  trace->records = (const void *)(header + 1);
+  trace->num = (trace->size - sizeof(*header)) / sizeof(struct trace_record);
+  return 0;
+}
+
+void trace_unmap(struct trace *trace)
+{
+  if (trace->map)
+    munmap(trace->map, trace->size);
+  memset(trace, 0, sizeof(*trace));
+}
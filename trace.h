@@ -0,0 +1,57 @@
+#ifndef __WII_TRACE_H__
+#define __WII_TRACE_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "xwiimote.h"
+
+/*
+ * Event trace file: a 64 byte header followed by fixed-size records in
+ * host byte order and layout, appended as events arrive. Records embed the
+ * event unchanged, so a mapped trace is replayed without copying; traces
+ * are only portable between hosts with the same struct xwii_event.
+ */
+
+#define TRACE_MAGIC "WIITRACE"
+#define TRACE_VERSION 1
+
+struct trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint8_t reserved[48];
+};
+
+struct trace_record {
+  /* remote index, 0..WIIMOTE_MAX-1 */
+  uint32_t dev;
+  uint32_t reserved;
+  struct xwii_event event;
+};
+
+/* append side */
+struct trace_writer {
+  FILE *file;
+  uint64_t num;
+};
+
+/* create or append to a trace, a torn last record is cut off */
+int trace_create(struct trace_writer *writer, const char *path);
+int trace_write(struct trace_writer *writer, unsigned int dev,
+                const struct xwii_event *event);
+int trace_close(struct trace_writer *writer);
+
+/* replay side, the records point into the mapping */
+struct trace {
+  void *map;
+  size_t size;
+  const struct trace_record *records;
+  size_t num;
+};
+
+int trace_map(struct trace *trace, const char *path);
+void trace_unmap(struct trace *trace);
+
+#endif /* __WII_TRACE_H__ */
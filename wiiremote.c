@@ -17,124 +17,301 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
-#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 #include "xwiimote.h"
 #include "mouse.h"
-
-static int mouse_fd = -1;
+#include "ir.h"
+#include "filter.h"
+#include "gyro.h"
+#include "mpcal.h"
+#include "fusion.h"
+#include "ring.h"
+#include "log.h"
+#include "trace.h"
+#include "latency.h"
+#include "config.h"
+#include "curve.h"
 
 enum window_mode {
   MODE_ERROR,
   MODE_NORMAL,
   MODE_EXTENDED,
   MODE_NFS,
+  MODE_IR,
+  MODE_GYRO,
+  MODE_NUM,
+};
+
+/* maximum number of remotes served by one process */
+#define WIIMOTE_MAX 4
+
+/* per-remote state, each remote drives its own virtual devices */
+struct wiimote {
+  unsigned int index;
+  struct xwii_iface *iface;
+  unsigned int mode;
+
+  int mouse_fd;
+  struct mouse_frame pointer_frame;
+  struct mouse_motion pointer_motion;
+  /* what each held key did on press, undone on release */
+  struct bind_action held[XWII_KEY_NUM];
+  /* absolute IR pointer, created when the remote first enters MODE_IR */
+  int ir_fd;
+  struct mouse_frame ir_frame;
+  struct ir_pointer ir_pointer;
+  /* gamepad, created when the remote first enters MODE_NFS, a pad
+   * binding is used or a Classic or Pro Controller reports; axes are
+   * coalesced per wakeup, the D-pad is kept to compute the hat; after a
+   * failure it is not tried again until the remote reattaches */
+  int pad_fd;
+  bool pad_failed;
+  struct mouse_frame pad_frame;
+  struct mouse_pad pad;
+  bool pad_dpad[4];
+  /* Nunchuk stick after dead zone and curve, -1..1 with y up; pointer
+   * and scroll integrate it at every motion flush since stick_last */
+  float stick[2];
+  double stick_last;
+  struct mouse_scroll scroll;
+  bool wasd[4];
+
+  struct filter_axis accel_filter[2];
+  struct filter_axis ir_filter[2];
+  struct filter_axis gyro_filter[2];
+  /* MotionPlus air mouse, holding B releases the clutch */
+  struct gyro_mouse gyro_mouse;
+  /* orientation from accelerometer + MotionPlus */
+  struct fusion fusion;
+  /* MotionPlus bias, learned while the remote is at rest */
+  struct mp_calib mp_calib;
+  /* mp_calib.norm as published by the main loop; whoever reads the remote
+   * hands it to the interface before its next dispatch */
+  _Atomic int32_t mp_norm[3];
+  atomic_bool mp_norm_pending;
+  /* stable identity (bluetooth address), empty if unknown */
+  char id[64];
+
+  bool led_state[4];
 };
 
-static struct xwii_iface *iface;
+static struct wiimote wiimotes[WIIMOTE_MAX];
+static unsigned int wiimote_num;
+
+/* mode new remotes start in */
 static unsigned int mode = MODE_NORMAL;
+/* modes by the names used on the command line and in the config */
+static const char *const mode_names[MODE_NUM] = {
+  [MODE_NORMAL] = "normal",
+  [MODE_NFS] = "nfs",
+  [MODE_IR] = "ir",
+  [MODE_GYRO] = "gyro",
+};
+/* key bindings the config file starts from */
+static const char default_bindings[] =
+  "[normal ir gyro]\n"
+  "up = wheel 1\n"
+  "down = wheel -1\n"
+  "a = button left\n"
+  "c = button right\n"
+  "z = button middle\n"
+  "nunchuk = scroll\n"
+  "[gyro]\n"
+  "b = clutch\n"
+  "[nfs]\n"
+  "one = pedal brake\n"
+  "two = pedal gas\n"
+  "a = pad south\n"
+  "b = pad east\n"
+  "plus = pad start\n"
+  "minus = pad select\n"
+  "home = pad mode\n";
+/*
+ * Bindings and tuning in effect, see config.c. The main thread takes it at
+ * every wakeup and must not keep it across a poll; -C reloads replace it.
+ */
+static const struct config *config;
 static bool freeze = false;
+/* -p: the reader thread owns the remotes' interfaces, see pipeline_start() */
+static bool pipelined;
+/* pointer output rate in Hz, 0 flushes motion after every wakeup */
+static unsigned int output_rate;
+#define OUTPUT_RATE_MAX 1000
+/* -R: handled events are appended to this trace */
+static struct trace_writer recorder;
+/* -P: replay a trace instead of reading remotes, -F without pacing */
+static const char *replay_path;
+static bool replay_fast;
 
-/* error messages */
+/*
+ * Defaults of the config, changed by the command line options. Pointer
+ * filter tuning per mode. Tilt values are in pixels per report,
+ * IR positions in 0..IR_ABS_MAX, hence the different scales.
+ */
+static struct filter_params filter_params[MODE_NUM] = {
+  [MODE_NORMAL] = {
+    .type = FILTER_ONE_EURO,
+    .min_cutoff = 1.0f, .beta = 0.05f, .d_cutoff = 1.0f,
+    .process_noise = 5000.0f, .measure_noise = 0.5f,
+  },
+  [MODE_EXTENDED] = {
+    .type = FILTER_ONE_EURO,
+    .min_cutoff = 1.0f, .beta = 0.05f, .d_cutoff = 1.0f,
+    .process_noise = 5000.0f, .measure_noise = 0.5f,
+  },
+  [MODE_IR] = {
+    .type = FILTER_ONE_EURO,
+    .min_cutoff = 1.0f, .beta = 0.0005f, .d_cutoff = 1.0f,
+    .process_noise = 1e7f, .measure_noise = 1600.0f,
+  },
+  [MODE_GYRO] = {
+    .type = FILTER_ONE_EURO,
+    .min_cutoff = 3.0f, .beta = 0.0005f, .d_cutoff = 1.0f,
+    .process_noise = 1e8f, .measure_noise = 400.0f,
+  },
+};
+/* MotionPlus air mouse response */
+static struct gyro_params gyro_params = {
+  .dead_zone = 60.0f,
+  .knee = 2000.0f,
+  .speed = 1500.0f,
+  .exponent = 1.5f,
+};
+/*
+ * Extended mode response curve for accelerometer values, pow(x, 1/4)
+ * compiled into tables over the raw range at startup.
+ */
+#define EXT_CURVE_RANGE 512
+static struct curve_params ext_curve_params = {
+  .type = CURVE_POWER,
+  .range = EXT_CURVE_RANGE,
+  .exponent = 0.25f,
+};
+/* X is shown at twice the scale of Y and Z */
+static struct curve ext_curve_x, ext_curve_yz;
+/* nfs: degrees of roll for full lock and straight ahead, linear in between */
+#define STEER_RANGE 60.0f
+#define STEER_DEAD_ZONE 2.0f
+/* Nunchuk stick: raw units ignored around the centre, a gentle curve, and
+ * pixels or wheel detents per second at full deflection */
+#define STICK_DEAD_ZONE 8.0f
+#define STICK_EXPONENT 1.5f
+#define STICK_SPEED 800.0f
+#define SCROLL_SPEED 10.0f
+#define WASD_THRESHOLD 0.5f
+/* tilt in pointer pixels per filtered accelerometer unit, before ballistics */
+#define TILT_PIXELS 10.0f
+/*
+ * Pointer ballistics per mode, gain by pointer speed, built into tables
+ * with the config; -a replaces them. The air mouse has its own response in
+ * gyro_params, so all modes default to a flat unity gain.
+ */
+static struct mouse_accel_params pointer_accel_params[MODE_NUM] = {
+  [MODE_NORMAL] = { .profile = MOUSE_ACCEL_FLAT, .gain = 1.0f },
+  [MODE_EXTENDED] = { .profile = MOUSE_ACCEL_FLAT, .gain = 1.0f },
+  [MODE_NFS] = { .profile = MOUSE_ACCEL_FLAT, .gain = 1.0f },
+  [MODE_IR] = { .profile = MOUSE_ACCEL_FLAT, .gain = 1.0f },
+  [MODE_GYRO] = { .profile = MOUSE_ACCEL_FLAT, .gain = 1.0f },
+};
 
-static void mvprintw(int x, int y, const char *format, ...)
+static double event_time(const struct xwii_event *event)
 {
-  va_list list;
-  va_start(list, format);
-  printf(format, list);
-  va_end(list);
+  return event->time.tv_sec + event->time.tv_usec / 1000000.0;
 }
 
-static void print_info(const char *format, ...)
-{
-  va_list list;
-  char str[58 + 1];
+/* messages, written asynchronously by the log thread */
 
-  va_start(list, format);
-  vsnprintf(str, sizeof(str), format, list);
-  str[sizeof(str) - 1] = 0;
-  va_end(list);
- printf("%s\n", str);
-}
+/* leftover screen output of xwiishow, only shown with -vv */
+#define mvprintw(y, x, ...)                    \
+  do {                                          \
+    (void)(y);                                  \
+    (void)(x);                                  \
+    log_printf(LOG_LEVEL_TRACE, __VA_ARGS__);   \
+  } while (0)
+#define print_info(...) log_printf(LOG_LEVEL_INFO, __VA_ARGS__)
+#define print_error(...) log_printf(LOG_LEVEL_ERROR, __VA_ARGS__)
 
-static void print_error(const char *format, ...)
-{
-  va_list list;
-  char str[58 + 80 + 1];
+/* key events */
 
-  va_start(list, format);
-  vsnprintf(str, sizeof(str), format, list);
-    str[58] = 0;
-  va_end(list);
+static void wiimote_set_mode(struct wiimote *dev, unsigned int new_mode);
+static int wiimote_pad_open(struct wiimote *dev);
 
-  printf("%s", str);
+/* tap the chords of a macro, one frame for presses and one for releases */
+static void key_macro(struct wiimote *dev, const struct bind_macro *macro)
+{
+  unsigned int i, j, start = 0;
+
+  for (i = 0; i < macro->num; i++) {
+    if (macro->steps[i])
+      continue;
+    for (j = start; j < i; j++)
+      mouse_frame_add(&dev->pointer_frame, EV_KEY, macro->steps[j], 1);
+    mouse_frame_flush(&dev->pointer_frame);
+    for (j = i; j-- > start;)
+      mouse_frame_add(&dev->pointer_frame, EV_KEY, macro->steps[j], 0);
+    mouse_frame_flush(&dev->pointer_frame);
+    start = i + 1;
+  }
 }
 
-/* key events */
-
-static void key_show(const struct xwii_event *event)
+static void key_show(struct wiimote *dev, const struct xwii_event *event)
 {
   unsigned int code = event->v.key.code;
-  bool pressed = event->v.key.state;
-  char *str = NULL;
+  unsigned int state = event->v.key.state;
+  const struct bind_action *action;
 
-  printf("code: %d pressed: %d\n", code, pressed);
+  log_printf(LOG_LEVEL_DEBUG, "Key: code %u pressed %u", code, state);
 
-  if (pressed)
-    str = "X";
-  else
-    str = " ";
-
-  if (code == XWII_KEY_LEFT) {
-    mvprintw(4, 7, "%s", str);
-  } else if (code == XWII_KEY_RIGHT) {
-    mvprintw(4, 11, "%s", str);
-  } else if (code == XWII_KEY_UP) {
-    switch(mode) {   
-      case MODE_NORMAL: mouse_send_wheel(mouse_fd, 1); break;
-    }
-  } else if (code == XWII_KEY_DOWN) {
-    switch(mode) {   
-       case MODE_NORMAL: mouse_send_wheel(mouse_fd, -1); break;
-    }
-  } else if (code == XWII_KEY_A) {
-    switch(mode) {   
-       case MODE_NORMAL: mouse_send_lmb(mouse_fd, pressed); break;
-    }
-  } else if (code == XWII_KEY_B) {
-    if (pressed)
-      str = "B";
-    mvprintw(10, 13, "%s", str);
-  } else if (code == XWII_KEY_HOME) {
-    if (pressed)
-      str = "HOME+";
-    else
-      str = "     ";
-    mvprintw(13, 7, "%s", str);
-  } else if (code == XWII_KEY_MINUS) {
-    if (pressed)
-      str = "-";
-    mvprintw(13, 3, "%s", str);
-  } else if (code == XWII_KEY_PLUS) {
-    if (pressed)
-      str = "+";
-    mvprintw(13, 15, "%s", str);
-  } else if (code == XWII_KEY_ONE) {
-    if (pressed)
-      str = "1";
-    mvprintw(20, 9, "%s", str);
-  } else if (code == XWII_KEY_TWO) {
-    if (pressed)
-      str = "2";
-    mvprintw(21, 9, "%s", str);
+  /* autorepeat is not bound to anything */
+  if (code >= XWII_KEY_NUM || state > 1)
+    return;
+
+  /* a release undoes what the press did, even after a mode switch */
+  if (state)
+    dev->held[code] = config->bindings.keys[dev->mode][code];
+  action = &dev->held[code];
+
+  switch (action->type) {
+  case BIND_KEY:
+    mouse_frame_add(&dev->pointer_frame, EV_KEY, action->code, state);
+    break;
+  case BIND_WHEEL:
+    if (state)
+      mouse_frame_wheel(&dev->pointer_frame, action->code, action->value);
+    break;
+  case BIND_MACRO:
+    if (state)
+      key_macro(dev, &config->bindings.macros[action->value]);
+    break;
+  case BIND_MODE:
+    if (state)
+      wiimote_set_mode(dev, action->value);
+    break;
+  case BIND_CLUTCH:
+    dev->gyro_mouse.released = state;
+    break;
+  case BIND_PAD:
+    if (!wiimote_pad_open(dev))
+      mouse_frame_add(&dev->pad_frame, EV_KEY, action->code, state);
+    break;
+  case BIND_PEDAL:
+    if (!wiimote_pad_open(dev))
+      mouse_pad_set(&dev->pad, action->code, state ? MOUSE_TRIGGER_MAX : 0);
+    break;
   }
 }
 
@@ -142,7 +319,7 @@ static void key_show(const struct xwii_event *event)
 
 static void accel_show_ext_x(double val)
 {
-  printf("accell_x=%f\n", val);
+  log_printf(LOG_LEVEL_TRACE, "accel_x=%f", val);
 }
 
 static void accel_show_ext_y(double val)
@@ -156,45 +333,75 @@ static void accel_show_ext_z(double val)
 
 static void accel_show_ext(const struct xwii_event *event)
 {
-  double val;
-
-  /* pow(val, 1/4) for smoother interpolation around the origin */
-
-  val = event->v.abs[0].x;
-  val /= 512;
-  if (val >= 0)
-    val = 10 * pow(val, 0.25);
-  else
-    val = -10 * pow(-val, 0.25);
-  accel_show_ext_x(val);
+  accel_show_ext_x(curve_apply(&ext_curve_x, event->v.abs[0].x));
+  accel_show_ext_z(curve_apply(&ext_curve_yz, event->v.abs[0].z));
+  accel_show_ext_y(curve_apply(&ext_curve_yz, event->v.abs[0].y));
+}
 
-  val = event->v.abs[0].z;
-  val /= 512;
-  if (val >= 0)
-    val = 5 * pow(val, 0.25);
+/*
+ * Steering wheel: the remote is held sideways, D-pad in the left hand and
+ * buttons facing the player, and turned like a wheel. Its roll goes to the
+ * gamepad's ABS_X with the next flush, in the wakeup of the report.
+ */
+static void nfs_steer(struct wiimote *dev, double t)
+{
+  const struct fusion *fu = &dev->fusion;
+  float g[3], angle, mag;
+  float range = config->steer_range, dead_zone = config->steer_dead_zone;
+
+  /* fused gravity is steadier, but without MotionPlus it trails the
+   * accelerometer; then the latest report is used as it is */
+  if (fusion_has_gyro(fu, t))
+    fusion_gravity(fu, g);
+  else if (fu->accel_ok)
+    memcpy(g, fu->accel, sizeof(g));
   else
-    val = -5 * pow(-val, 0.25);
-  accel_show_ext_z(val);
+    return;
 
-  val = event->v.abs[0].y;
-  val /= 512;
-  if (val >= 0)
-    val = 5 * pow(val, 0.25);
-  else
-    val = -5 * pow(-val, 0.25);
-  accel_show_ext_y(val);
+  /* held straight, x points up; turning right tilts it towards y */
+  angle = atan2f(g[1], g[0]) * (180.0f / (float)M_PI);
+  mag = fabsf(angle) - dead_zone;
+  if (mag < 0)
+    mag = 0;
+  mag *= range / (range - dead_zone);
+  mouse_pad_set(&dev->pad, ABS_X,
+                curve_apply(&config->steer,
+                            lroundf(copysignf(mag, angle) * CONFIG_STEER_UNITS)));
 }
 
-static void accel_show(const struct xwii_event *event)
+static void accel_show(struct wiimote *dev, const struct xwii_event *event)
 {
   float dx = 0.01f * event->v.abs[0].x;
   float dy = 0.01f * event->v.abs[0].y;
   float dz = 0.01f * event->v.abs[0].z;
+  float g[3];
+
+  mp_calib_accel(&dev->mp_calib, &event->v.abs[0]);
+  fusion_accel(&dev->fusion, &event->v.abs[0], event_time(event));
   //printf("AX=%d AY=%d AZ=%d\n", event->v.abs[0].x, event->v.abs[0].y, event->v.abs[0].z);
   //printf("AX=%f AY=%f AZ=%f\n", dx, dy, dz);
-  if(mouse_fd>=0) {
-     mouse_move_relative(mouse_fd, 10*dx, 10*dy);
+
+  /* IR does the pointing, the orientation only provides the roll; as in
+   * nfs_steer(), accelerometer-only fusion would trail the real roll */
+  if (dev->mode == MODE_IR) {
+    if (fusion_has_gyro(&dev->fusion, event_time(event))) {
+      fusion_gravity(&dev->fusion, g);
+      ir_pointer_set_gravity(&dev->ir_pointer, g[0], g[2]);
+    } else if (dev->fusion.accel_ok) {
+      ir_pointer_set_gravity(&dev->ir_pointer, dev->fusion.accel[0],
+                             dev->fusion.accel[2]);
+    }
+    return;
+  } else if (dev->mode == MODE_GYRO) {
+    return;
+  } else if (dev->mode == MODE_NFS) {
+    nfs_steer(dev, event_time(event));
+    return;
   }
+
+  dx = filter_apply(&config->filter[dev->mode], &dev->accel_filter[0], dx, event_time(event));
+  dy = filter_apply(&config->filter[dev->mode], &dev->accel_filter[1], dy, event_time(event));
+  mouse_motion_add(&dev->pointer_motion, TILT_PIXELS * dx, TILT_PIXELS * dy);
 }
 
 
@@ -204,53 +411,111 @@ static void ir_show_ext(const struct xwii_event *event)
 {
 }
 
-static void ir_show(const struct xwii_event *event)
+static void ir_show(struct wiimote *dev, const struct xwii_event *event)
 {
+  int x, y;
+
+  if (dev->mode != MODE_IR)
+    return;
+
+  if (ir_pointer_update(&dev->ir_pointer, event->v.abs)) {
+    x = filter_apply(&config->filter[dev->mode], &dev->ir_filter[0], dev->ir_pointer.x,
+                     event_time(event));
+    y = filter_apply(&config->filter[dev->mode], &dev->ir_filter[1], dev->ir_pointer.y,
+                     event_time(event));
+    mouse_frame_add(&dev->ir_frame, EV_ABS, ABS_X, x);
+    mouse_frame_add(&dev->ir_frame, EV_ABS, ABS_Y, y);
+  }
 }
 
 
 /* motion plus */
 
-static bool mp_do_refresh;
 
-static void mp_show(const struct xwii_event *event)
+/* reader side: apply the published normalization */
+static void mp_refresh(struct wiimote *dev)
 {
-  static int32_t mp_x, mp_y;
-  int32_t x, y, z, factor, i;
+  xwii_iface_set_mp_normalization(dev->iface, atomic_load(&dev->mp_norm[0]),
+                                  atomic_load(&dev->mp_norm[1]),
+                                  atomic_load(&dev->mp_norm[2]), 0);
+}
 
-  if (mp_do_refresh) {
-    xwii_iface_get_mp_normalization(iface, &x, &y, &z, &factor);
-    x = event->v.abs[0].x + x;
-    y = event->v.abs[0].y + y;
-    z = event->v.abs[0].z + z;
-    xwii_iface_set_mp_normalization(iface, x, y, z, factor);
-  }
+/*
+ * Main loop side: publish mp_calib.norm. With -p the interface belongs to
+ * the reader thread, which picks the values up before its next dispatch.
+ */
+static void mp_publish(struct wiimote *dev)
+{
+  unsigned int i;
 
-  x = event->v.abs[0].x;
-  y = event->v.abs[0].y;
-  z = event->v.abs[0].z;
+  for (i = 0; i < 3; i++)
+    atomic_store(&dev->mp_norm[i], dev->mp_calib.norm[i]);
+  if (pipelined)
+    atomic_store(&dev->mp_norm_pending, true);
+  else
+    mp_refresh(dev);
+}
 
-  //printf("x=%d y=%d z=%d\n", x, y, z);
+/* air mouse: turning the remote moves the pointer, MotionPlus x turns it
+ * horizontally, z vertically */
+static void mp_pointer(struct wiimote *dev, const struct xwii_event *event)
+{
+  float rx, ry, dx, dy;
+  double t = event_time(event);
+
+  rx = filter_apply(&config->filter[dev->mode], &dev->gyro_filter[0],
+                    event->v.abs[0].x, t);
+  ry = filter_apply(&config->filter[dev->mode], &dev->gyro_filter[1],
+                    event->v.abs[0].z, t);
+  gyro_mouse_update(&config->gyro, &dev->gyro_mouse, rx, ry, t, &dx, &dy);
+  mouse_motion_add(&dev->pointer_motion, dx, dy);
+}
 
+static void mp_show(struct wiimote *dev, const struct xwii_event *event)
+{
+  /* the bias estimate only changes while the remote is at rest; replayed
+   * samples were normalized when they were recorded */
+  if (mp_calib_sample(&dev->mp_calib, &event->v.abs[0]) && dev->iface)
+    mp_publish(dev);
+  fusion_gyro(&dev->fusion, &event->v.abs[0], event_time(event));
+
+  if (dev->mode == MODE_GYRO)
+    mp_pointer(dev, event);
+}
 
-  /* use x value unchanged for X-direction */
-  mp_x += x / 100;
-  mp_x = (mp_x < 0) ? 0 : ((mp_x > 10000) ? 10000 : mp_x);
-  /* use z value unchanged for Z-direction */
-  mp_y += z / 100;
-  mp_y = (mp_y < 0) ? 0 : ((mp_y > 10000) ? 10000 : mp_y);
 
-  x = mp_x * 22 / 10000;
-  x = (x < 0) ? 0 : ((x > 22) ? 22 : x);
-  y = mp_y * 7 / 10000;
-  y = (y < 0) ? 0 : ((y > 7) ? 7 : y);
-  //printf("x=%d y=%d z=%d\n", x, y, z);
+static void mp_calib_attach(struct wiimote *dev)
+{
+  char id[sizeof(dev->id)];
+  unsigned int i;
+
+  if (mp_calib_device_id(xwii_iface_get_syspath(dev->iface), id, sizeof(id)))
+    id[0] = 0;
+
+  /* the same remote reconnecting keeps what was learned so far */
+  if (!id[0] || strcmp(id, dev->id)) {
+    strcpy(dev->id, id);
+    mp_calib_init(&dev->mp_calib);
+    if (id[0] && !mp_calib_load(&dev->mp_calib, dev->id))
+      print_info("Info: Loaded MotionPlus calibration for %s", dev->id);
+  }
+  /* the reader does not poll the remote yet, so apply it right away */
+  atomic_store(&dev->mp_norm_pending, false);
+  for (i = 0; i < 3; i++)
+    atomic_store(&dev->mp_norm[i], dev->mp_calib.norm[i]);
+  mp_refresh(dev);
 }
 
-
-static void mp_refresh(void)
+static void mp_calib_store(struct wiimote *dev)
 {
-  mp_do_refresh = true;
+  int ret;
+
+  if (!dev->id[0])
+    return;
+
+  ret = mp_calib_save(&dev->mp_calib, dev->id);
+  if (ret)
+    print_error("Error: Cannot save MotionPlus calibration: %d", ret);
 }
 
 /* nunchuk */
@@ -270,38 +535,12 @@ static void nunchuk_show_ext_z(double val)
 
 static void nunchuk_show_ext(const struct xwii_event *event)
 {
-  double val;
   const char *str = " ";
-  int32_t v;
 
   if (event->type == XWII_EVENT_NUNCHUK_MOVE) {
-    /* pow(val, 1/4) for smoother interpolation around the origin */
-
-    val = event->v.abs[1].x;
-    val /= 512;
-    if (val >= 0)
-      val = 10 * pow(val, 0.25);
-    else
-      val = -10 * pow(-val, 0.25);
-    nunchuk_show_ext_x(val);
-
-    val = event->v.abs[1].z;
-    val /= 512;
-    if (val >= 0)
-      val = 5 * pow(val, 0.25);
-    else
-      val = -5 * pow(-val, 0.25);
-    nunchuk_show_ext_z(val);
-
-    val = event->v.abs[1].y;
-    val /= 512;
-    if (val >= 0)
-      val = 5 * pow(val, 0.25);
-    else
-      val = -5 * pow(-val, 0.25);
-    nunchuk_show_ext_y(val);
-
-    v = event->v.abs[0].x * 12;
+    nunchuk_show_ext_x(curve_apply(&ext_curve_x, event->v.abs[1].x));
+    nunchuk_show_ext_z(curve_apply(&ext_curve_yz, event->v.abs[1].z));
+    nunchuk_show_ext_y(curve_apply(&ext_curve_yz, event->v.abs[1].y));
   }
 
   if (event->type == XWII_EVENT_NUNCHUK_KEY) {
@@ -317,6 +556,89 @@ static void nunchuk_show_ext(const struct xwii_event *event)
   }
 }
 
+/*
+ * Nunchuk stick as a second pointer, scroll wheel or WASD keys, as the
+ * mode's config says. C and Z are remote keys and go through the bindings.
+ */
+
+static const uint16_t wasd_keys[4] = { KEY_A, KEY_D, KEY_W, KEY_S };
+
+/* a WASD key is released below this share of wasd_threshold */
+#define STICK_WASD_RELEASE 0.75f
+
+static float stick_axis(unsigned int axis, int32_t raw)
+{
+  int32_t dead_zone = lroundf(config->stick_dead_zone[axis]);
+  int32_t mag = abs(raw) - dead_zone;
+
+  if (mag <= 0)
+    return 0;
+  return curve_apply(&config->stick_curve[axis], raw < 0 ? -mag : mag);
+}
+
+static void nunchuk_wasd(struct wiimote *dev, bool off)
+{
+  float t = config->wasd_threshold;
+  float v[4] = { -dev->stick[0], dev->stick[0], dev->stick[1], -dev->stick[1] };
+  unsigned int i;
+  bool down;
+
+  for (i = 0; i < 4; i++) {
+    down = !off && v[i] >= (dev->wasd[i] ? t * STICK_WASD_RELEASE : t);
+    if (down != dev->wasd[i]) {
+      mouse_frame_add(&dev->pointer_frame, EV_KEY, wasd_keys[i], down);
+      dev->wasd[i] = down;
+    }
+  }
+}
+
+/* centre the stick when the Nunchuk goes away */
+static void nunchuk_reset(struct wiimote *dev)
+{
+  dev->stick[0] = dev->stick[1] = 0;
+  dev->scroll.wheel = dev->scroll.hwheel = 0;
+  nunchuk_wasd(dev, true);
+}
+
+static void nunchuk_show(struct wiimote *dev, const struct xwii_event *event)
+{
+  dev->stick[0] = stick_axis(0, event->v.abs[0].x);
+  dev->stick[1] = stick_axis(1, event->v.abs[0].y);
+  /* also lets go of the keys if a reload turned WASD off */
+  nunchuk_wasd(dev, config->stick[dev->mode] != CONFIG_STICK_WASD);
+}
+
+/* move the pointer or scroll by the stick for the time since the last call */
+static void nunchuk_motion(struct wiimote *dev)
+{
+  struct timespec ts;
+  double now, dt;
+  float speed;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts.tv_sec + ts.tv_nsec * 1e-9;
+  dt = now - dev->stick_last;
+  dev->stick_last = now;
+  if (!dev->stick[0] && !dev->stick[1])
+    return;
+  /* a stalled loop must not turn into a jump */
+  if (dt > 0.05)
+    dt = 0.05;
+
+  switch (config->stick[dev->mode]) {
+  case CONFIG_STICK_POINTER:
+    speed = config->stick_speed * dt;
+    mouse_motion_add(&dev->pointer_motion, speed * dev->stick[0],
+                     -speed * dev->stick[1]);
+    break;
+  case CONFIG_STICK_SCROLL:
+    speed = config->scroll_speed * MOUSE_WHEEL_HI_RES * dt;
+    mouse_scroll_add(&dev->scroll, speed * dev->stick[1],
+                     speed * dev->stick[0]);
+    break;
+  }
+}
+
 
 /* balance board */
 
@@ -618,6 +940,117 @@ static void classic_show_ext(const struct xwii_event *event)
 }
 
 
+/*
+ * Classic and Pro Controller as a gamepad. Buttons keep their position on
+ * a standard pad, so A is east and B south. Sticks and triggers only set
+ * the axes; a report's changes go out in one frame with the next flush.
+ */
+
+/* nominal stick deflection, the kernel reports a little beyond it */
+#define PRO_STICK_MAX 1024
+#define CLASSIC_STICK_MAX 30
+#define CLASSIC_TRIGGER_MAX 31
+
+static const uint16_t pad_keys[XWII_KEY_NUM] = {
+  [XWII_KEY_A] = BTN_EAST, [XWII_KEY_B] = BTN_SOUTH,
+  [XWII_KEY_X] = BTN_NORTH, [XWII_KEY_Y] = BTN_WEST,
+  [XWII_KEY_TL] = BTN_TL, [XWII_KEY_TR] = BTN_TR,
+  [XWII_KEY_ZL] = BTN_TL2, [XWII_KEY_ZR] = BTN_TR2,
+  [XWII_KEY_MINUS] = BTN_SELECT, [XWII_KEY_PLUS] = BTN_START,
+  [XWII_KEY_HOME] = BTN_MODE,
+  [XWII_KEY_THUMBL] = BTN_THUMBL, [XWII_KEY_THUMBR] = BTN_THUMBR,
+};
+
+/* Classic analog triggers are L and R, so they swap with ZL and ZR */
+static const uint16_t classic_keys[XWII_KEY_NUM] = {
+  [XWII_KEY_TL] = BTN_TL2, [XWII_KEY_TR] = BTN_TR2,
+  [XWII_KEY_ZL] = BTN_TL, [XWII_KEY_ZR] = BTN_TR,
+};
+
+static int32_t pad_scale(int32_t v, int32_t max, int32_t out)
+{
+  if (v > max)
+    v = max;
+  else if (v < -max)
+    v = -max;
+  return v * out / max;
+}
+
+static void pad_dpad(struct wiimote *dev, unsigned int code, bool pressed)
+{
+  bool *d = dev->pad_dpad;
+
+  switch (code) {
+  case XWII_KEY_LEFT:
+    d[0] = pressed;
+    break;
+  case XWII_KEY_RIGHT:
+    d[1] = pressed;
+    break;
+  case XWII_KEY_UP:
+    d[2] = pressed;
+    break;
+  case XWII_KEY_DOWN:
+    d[3] = pressed;
+    break;
+  }
+  mouse_pad_set(&dev->pad, ABS_HAT0X, d[1] - d[0]);
+  mouse_pad_set(&dev->pad, ABS_HAT0Y, d[3] - d[2]);
+}
+
+static void pad_show(struct wiimote *dev, const struct xwii_event *event)
+{
+  bool classic = event->type == XWII_EVENT_CLASSIC_CONTROLLER_KEY ||
+                 event->type == XWII_EVENT_CLASSIC_CONTROLLER_MOVE;
+  int32_t max = classic ? CLASSIC_STICK_MAX : PRO_STICK_MAX;
+  unsigned int code = event->v.key.code;
+  bool pressed = event->v.key.state;
+  uint16_t btn;
+
+  if (wiimote_pad_open(dev))
+    return;
+
+  if (event->type == XWII_EVENT_CLASSIC_CONTROLLER_MOVE ||
+      event->type == XWII_EVENT_PRO_CONTROLLER_MOVE) {
+    /* evdev convention already: y grows downwards on both sticks */
+    mouse_pad_set(&dev->pad, ABS_X,
+                  pad_scale(event->v.abs[0].x, max, MOUSE_STICK_MAX));
+    mouse_pad_set(&dev->pad, ABS_Y,
+                  pad_scale(event->v.abs[0].y, max, MOUSE_STICK_MAX));
+    mouse_pad_set(&dev->pad, ABS_RX,
+                  pad_scale(event->v.abs[1].x, max, MOUSE_STICK_MAX));
+    mouse_pad_set(&dev->pad, ABS_RY,
+                  pad_scale(event->v.abs[1].y, max, MOUSE_STICK_MAX));
+    if (classic) {
+      mouse_pad_set(&dev->pad, ABS_Z,
+                    pad_scale(event->v.abs[2].x, CLASSIC_TRIGGER_MAX,
+                              MOUSE_TRIGGER_MAX));
+      mouse_pad_set(&dev->pad, ABS_RZ,
+                    pad_scale(event->v.abs[2].y, CLASSIC_TRIGGER_MAX,
+                              MOUSE_TRIGGER_MAX));
+    }
+    return;
+  }
+
+  /* autorepeat carries no new state */
+  if (code >= XWII_KEY_NUM || event->v.key.state > 1)
+    return;
+  if (code <= XWII_KEY_DOWN) {
+    pad_dpad(dev, code, pressed);
+    return;
+  }
+
+  btn = classic && classic_keys[code] ? classic_keys[code] : pad_keys[code];
+  if (btn)
+    mouse_frame_add(&dev->pad_frame, EV_KEY, btn, pressed);
+  /* the Pro Controller's triggers are digital, the axes follow them */
+  if (!classic && code == XWII_KEY_ZL)
+    mouse_pad_set(&dev->pad, ABS_Z, pressed ? MOUSE_TRIGGER_MAX : 0);
+  else if (!classic && code == XWII_KEY_ZR)
+    mouse_pad_set(&dev->pad, ABS_RZ, pressed ? MOUSE_TRIGGER_MAX : 0);
+}
+
+
 /* guitar */
 static void guit_show_ext(const struct xwii_event *event)
 {
@@ -1058,22 +1491,20 @@ static void drums_show_ext(const struct xwii_event *event)
 
 /* LEDs */
 
-static bool led_state[4];
-
 static void led_show(int n, bool on)
 {
   mvprintw(5, 59 + n*5, on ? "(#%i)" : " -%i ", n+1);
 }
 
-static void led_refresh(int n)
+static void led_refresh(struct wiimote *dev, int n)
 {
   int ret;
 
-  ret = xwii_iface_get_led(iface, XWII_LED(n+1), &led_state[n]);
+  ret = xwii_iface_get_led(dev->iface, XWII_LED(n+1), &dev->led_state[n]);
   if (ret)
     print_error("Error: Cannot read LED state");
   else
-    led_show(n, led_state[n]);
+    led_show(n, dev->led_state[n]);
 }
 
 /* battery status */
@@ -1089,12 +1520,12 @@ static void battery_show(uint8_t capacity)
     mvprintw(7, 35 + i, "#");
 }
 
-static void battery_refresh(void)
+static void battery_refresh(struct wiimote *dev)
 {
   int ret;
   uint8_t capacity;
 
-  ret = xwii_iface_get_battery(iface, &capacity);
+  ret = xwii_iface_get_battery(dev->iface, &capacity);
   if (ret)
     print_error("Error: Cannot read battery capacity");
   else
@@ -1103,12 +1534,12 @@ static void battery_refresh(void)
 
 /* device type */
 
-static void devtype_refresh(void)
+static void devtype_refresh(struct wiimote *dev)
 {
   int ret;
   char *name;
 
-  ret = xwii_iface_get_devtype(iface, &name);
+  ret = xwii_iface_get_devtype(dev->iface, &name);
   if (ret) {
     print_error("Error: Cannot read device type");
   } else {
@@ -1120,12 +1551,12 @@ static void devtype_refresh(void)
 
 /* extension type */
 
-static void extension_refresh(void)
+static void extension_refresh(struct wiimote *dev)
 {
   int ret;
   char *name;
 
-  ret = xwii_iface_get_extension(iface, &name);
+  ret = xwii_iface_get_extension(dev->iface, &name);
   if (ret) {
     print_error("Error: Cannot read extension type");
   } else {
@@ -1134,7 +1565,7 @@ static void extension_refresh(void)
     free(name);
   }
 
-  if (xwii_iface_available(iface) & XWII_IFACE_MOTION_PLUS)
+  if (xwii_iface_available(dev->iface) & XWII_IFACE_MOTION_PLUS)
     mvprintw(7, 77, "M+");
   else
     mvprintw(7, 77, "  ");
@@ -1142,16 +1573,16 @@ static void extension_refresh(void)
 
 /* basic window setup */
 
-static void refresh_all(void)
+static void refresh_all(struct wiimote *dev)
 {
-  battery_refresh();
-  led_refresh(0);
-  led_refresh(1);
-  led_refresh(2);
-  led_refresh(3);
-  devtype_refresh();
-  extension_refresh();
-  mp_refresh();
+  battery_refresh(dev);
+  led_refresh(dev, 0);
+  led_refresh(dev, 1);
+  led_refresh(dev, 2);
+  led_refresh(dev, 3);
+  devtype_refresh(dev);
+  extension_refresh(dev);
+  mp_refresh(dev);
 
   if (geteuid() != 0)
     mvprintw(20, 22, "Warning: Please run as root! (sysfs+evdev access needed)");
@@ -1160,124 +1591,854 @@ static void refresh_all(void)
 
 /* device watch events */
 
-static void handle_watch(void)
+/*
+ * Open interfaces that appeared, e.g. a hotplugged extension, and read the
+ * remote's state again. This changes the fds behind xwii_iface_dispatch()
+ * and is done by whoever reads the remote, before the watch event is
+ * handled.
+ */
+static void wiimote_reopen(struct wiimote *dev)
 {
-  static unsigned int num;
   int ret;
 
+  ret = xwii_iface_open(dev->iface, xwii_iface_available(dev->iface) |
+             XWII_IFACE_WRITABLE);
+  if (ret)
+    print_error("Error: Cannot open interface: %d", ret);
+  refresh_all(dev);
+}
+
+static void handle_watch(struct wiimote *dev)
+{
+  static unsigned int num;
+
   print_info("Info: Watch Event #%u", ++num);
+  /* an unplugged Nunchuk sends no final centred report */
+  nunchuk_reset(dev);
+}
 
-  ret = xwii_iface_open(iface, xwii_iface_available(iface) |
-             XWII_IFACE_WRITABLE);
+/* event dispatching */
+
+static void handle_event(struct wiimote *dev, const struct xwii_event *event)
+{
+  switch (event->type) {
+  case XWII_EVENT_WATCH:
+    handle_watch(dev);
+    break;
+  case XWII_EVENT_KEY:
+    if (dev->mode != MODE_ERROR) {
+      log_printf(LOG_LEVEL_TRACE, "Event: key on #%u", dev->index + 1);
+      key_show(dev, event);
+    }
+    break;
+  case XWII_EVENT_ACCEL:
+    if (dev->mode == MODE_EXTENDED)
+      accel_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      accel_show(dev, event);
+    break;
+  case XWII_EVENT_IR:
+    if (dev->mode == MODE_EXTENDED)
+      ir_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      ir_show(dev, event);
+    break;
+  case XWII_EVENT_MOTION_PLUS:
+    if (dev->mode != MODE_ERROR)
+      mp_show(dev, event);
+    break;
+  case XWII_EVENT_NUNCHUK_KEY:
+    if (dev->mode == MODE_EXTENDED)
+      nunchuk_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      key_show(dev, event);
+    break;
+  case XWII_EVENT_NUNCHUK_MOVE:
+    if (dev->mode == MODE_EXTENDED)
+      nunchuk_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      nunchuk_show(dev, event);
+    break;
+  case XWII_EVENT_CLASSIC_CONTROLLER_KEY:
+  case XWII_EVENT_CLASSIC_CONTROLLER_MOVE:
+    if (dev->mode == MODE_EXTENDED)
+      classic_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      pad_show(dev, event);
+    break;
+  case XWII_EVENT_BALANCE_BOARD:
+    if (dev->mode == MODE_EXTENDED)
+      bboard_show_ext(event);
+    break;
+  case XWII_EVENT_PRO_CONTROLLER_KEY:
+  case XWII_EVENT_PRO_CONTROLLER_MOVE:
+    if (dev->mode == MODE_EXTENDED)
+      pro_show_ext(event);
+    if (dev->mode != MODE_ERROR)
+      pad_show(dev, event);
+    break;
+  case XWII_EVENT_GUITAR_KEY:
+  case XWII_EVENT_GUITAR_MOVE:
+    if (dev->mode == MODE_EXTENDED)
+      guit_show_ext(event);
+    break;
+  case XWII_EVENT_DRUMS_KEY:
+  case XWII_EVENT_DRUMS_MOVE:
+    if (dev->mode == MODE_EXTENDED)
+      drums_show_ext(event);
+    break;
+  }
+}
+
+/* wakeup statistics: how many events each poll() wakeup delivered */
+
+#define BURST_BUCKETS 8
+
+static struct {
+  uint64_t wakeups;
+  uint64_t events;
+  unsigned int max_burst;
+  /* bucket n counts bursts of [2^(n-1), 2^n) events, bucket 0 empty ones */
+  uint64_t hist[BURST_BUCKETS];
+} burst_stats;
+
+static void burst_account(unsigned int num)
+{
+  unsigned int n = 0;
+
+  while (num >> n && n < BURST_BUCKETS - 1)
+    ++n;
+
+  burst_stats.wakeups++;
+  burst_stats.events += num;
+  burst_stats.hist[n]++;
+  if (num > burst_stats.max_burst)
+    burst_stats.max_burst = num;
+}
+
+static void burst_print(void)
+{
+  unsigned int n;
+
+  if (!burst_stats.wakeups)
+    return;
+
+  print_info("Info: %" PRIu64 " events in %" PRIu64 " wakeups (%.2f/wakeup, max %u)",
+             burst_stats.events, burst_stats.wakeups,
+             (double)burst_stats.events / burst_stats.wakeups,
+             burst_stats.max_burst);
+  for (n = 0; n < BURST_BUCKETS; n++) {
+    if (!burst_stats.hist[n])
+      continue;
+    if (!n)
+      print_info("       0 events: %" PRIu64, burst_stats.hist[n]);
+    else if (n == BURST_BUCKETS - 1)
+      print_info("  >= %4u events: %" PRIu64, 1u << (n - 1),
+                 burst_stats.hist[n]);
+    else
+      print_info("  %4u-%-4u events: %" PRIu64, 1u << (n - 1),
+                 (1u << n) - 1, burst_stats.hist[n]);
+  }
+}
+
+static volatile sig_atomic_t quit;
+/* SIGUSR1: print the latency histograms at the next wakeup */
+static volatile sig_atomic_t dump_latency;
+
+static void handle_signal(int sig)
+{
+  if (sig == SIGUSR1)
+    dump_latency = 1;
+  else
+    quit = 1;
+}
+
+static void check_dump(void)
+{
+  if (!dump_latency)
+    return;
+
+  dump_latency = 0;
+  latency_dump();
+}
+
+/* periodic timer pacing pointer motion output, -1 if disabled */
+static int output_timer_new(unsigned int rate)
+{
+  struct itimerspec its;
+  int fd;
+
+  if (!rate)
+    return -1;
+
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    print_error("Error: Cannot create output timer: %d", -errno);
+    return -1;
+  }
+
+  memset(&its, 0, sizeof(its));
+  its.it_interval.tv_sec = 1 / rate;
+  its.it_interval.tv_nsec = rate > 1 ? 1000000000L / rate : 0;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+    print_error("Error: Cannot arm output timer: %d", -errno);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* remotes and their virtual devices */
+
+static int wiimote_ir_open(struct wiimote *dev)
+{
+  char name[64];
+
+  snprintf(name, sizeof(name), "wiiremote IR pointer %u", dev->index + 1);
+  dev->ir_fd = mouse_init_absolute(IR_ABS_MAX, name);
+  mouse_frame_init(&dev->ir_frame, dev->ir_fd);
+  return dev->ir_fd < 0 ? dev->ir_fd : 0;
+}
+
+/* create the gamepad on first use, 0 if it exists */
+static int wiimote_pad_open(struct wiimote *dev)
+{
+  char name[64];
+  int ret;
+
+  if (dev->pad_fd >= 0)
+    return 0;
+  /* reports come at up to 100 Hz, do not retry and log each one */
+  if (dev->pad_failed)
+    return -ENODEV;
+
+  snprintf(name, sizeof(name), "wiiremote gamepad %u", dev->index + 1);
+  ret = mouse_init_gamepad(name);
+  if (ret < 0) {
+    print_error("Error: Cannot create gamepad for device #%u: %s",
+                dev->index + 1, strerror(-ret));
+    dev->pad_failed = true;
+    return ret;
+  }
+  dev->pad_fd = ret;
+  mouse_frame_init(&dev->pad_frame, dev->pad_fd);
+  return 0;
+}
+
+/*
+ * Switch a remote to another mode while running, e.g. from a key binding.
+ * Tracking state of the old mode is dropped and the wheel centred; the IR
+ * pointer and the gamepad are created the first time they are needed.
+ */
+static void wiimote_set_mode(struct wiimote *dev, unsigned int new_mode)
+{
+  int ret;
+
+  if (dev->mode == new_mode)
+    return;
+
+  if (new_mode == MODE_IR && dev->ir_fd < 0) {
+    ret = wiimote_ir_open(dev);
+    if (ret) {
+      print_error("Error: Cannot create IR pointer for device #%u: %s",
+                  dev->index + 1, strerror(-ret));
+      return;
+    }
+  }
+  if (new_mode == MODE_NFS && wiimote_pad_open(dev))
+    return;
+
+  dev->mode = new_mode;
+  memset(dev->accel_filter, 0, sizeof(dev->accel_filter));
+  memset(dev->ir_filter, 0, sizeof(dev->ir_filter));
+  memset(dev->gyro_filter, 0, sizeof(dev->gyro_filter));
+  ir_pointer_init(&dev->ir_pointer);
+  gyro_mouse_init(&dev->gyro_mouse);
+  dev->pointer_motion.x = dev->pointer_motion.y = 0;
+  mouse_pad_set(&dev->pad, ABS_X, 0);
+  /* the stick keeps its position, only what it drives changes */
+  dev->scroll.wheel = dev->scroll.hwheel = 0;
+  nunchuk_wasd(dev, config->stick[new_mode] != CONFIG_STICK_WASD);
+  print_info("Info: Device #%u switched to %s mode", dev->index + 1,
+             mode_names[new_mode]);
+}
+
+static void wiimote_init(struct wiimote *dev, unsigned int index,
+                         const char *fallback)
+{
+  char name[64];
+
+  memset(dev, 0, sizeof(*dev));
+  dev->index = index;
+  dev->mode = mode;
+
+  snprintf(name, sizeof(name), "wiiremote pointer %u", index + 1);
+  dev->mouse_fd = mouse_init(fallback, name, config->bindings.codes);
+  mouse_frame_init(&dev->pointer_frame, dev->mouse_fd);
+
+  dev->ir_fd = -1;
+  mouse_frame_init(&dev->ir_frame, dev->ir_fd);
+  if (dev->mode == MODE_IR && wiimote_ir_open(dev)) {
+    print_error("Error create IR pointer:%s", strerror(-dev->ir_fd));
+    exit(EXIT_FAILURE);
+  }
+
+  dev->pad_fd = -1;
+  mouse_frame_init(&dev->pad_frame, dev->pad_fd);
+  if (dev->mode == MODE_NFS && wiimote_pad_open(dev))
+    exit(EXIT_FAILURE);
+
+  ir_pointer_init(&dev->ir_pointer);
+  gyro_mouse_init(&dev->gyro_mouse);
+  fusion_init(&dev->fusion);
+}
+
+static int wiimote_open(struct wiimote *dev, const char *path)
+{
+  int ret;
+
+  ret = xwii_iface_new(&dev->iface, path);
+  if (ret) {
+    print_error("Cannot create xwii_iface '%s' err:%d", path, ret);
+    dev->iface = NULL;
+    return ret;
+  }
+
+  ret = xwii_iface_open(dev->iface, xwii_iface_available(dev->iface) |
+                        XWII_IFACE_WRITABLE);
   if (ret)
     print_error("Error: Cannot open interface: %d", ret);
 
-  refresh_all();
+  ret = xwii_iface_watch(dev->iface, true);
+  if (ret)
+    print_error("Error: Cannot initialize hotplug watch descriptor");
+
+  mp_calib_attach(dev);
+  /* a reattached remote may try the gamepad again */
+  dev->pad_failed = false;
+  return 0;
 }
 
-/* keyboard handling */
+static void wiimote_close(struct wiimote *dev)
+{
+  if (!dev->iface)
+    return;
 
+  mp_calib_store(dev);
+  xwii_iface_unref(dev->iface);
+  dev->iface = NULL;
+}
+
+static void wiimote_free(struct wiimote *dev)
+{
+  wiimote_close(dev);
+  mouse_close(dev->mouse_fd);
+  mouse_close(dev->ir_fd);
+  mouse_close(dev->pad_fd);
+}
 
-static int run_iface(struct xwii_iface *iface)
+/* send what the last wakeup produced, one frame per virtual device */
+static void wiimote_flush(struct wiimote *dev, bool motion)
+{
+  if (motion) {
+    /* looked up per flush, so a mode switch changes the ballistics */
+    nunchuk_motion(dev);
+    dev->pointer_motion.accel = &config->accel[dev->mode];
+    mouse_motion_flush(&dev->pointer_motion, &dev->pointer_frame);
+    mouse_scroll_flush(&dev->scroll, &dev->pointer_frame);
+  }
+  if (dev->pad_fd >= 0)
+    mouse_pad_flush(&dev->pad, &dev->pad_frame);
+  mouse_frame_flush(&dev->ir_frame);
+  mouse_frame_flush(&dev->pad_frame);
+  mouse_frame_flush(&dev->pointer_frame);
+}
+
+static void record_event(struct wiimote *dev, const struct xwii_event *event)
+{
+  if (!recorder.file)
+    return;
+
+  if (trace_write(&recorder, dev->index, event)) {
+    print_error("Error: Cannot write trace, recording stopped");
+    trace_close(&recorder);
+  }
+}
+
+/*
+ * Drain the whole burst a remote queued up before going back to epoll.
+ * Returns the number of events read; the remote is detached when it is
+ * gone or fails.
+ */
+static unsigned int wiimote_dispatch(struct wiimote *dev, int epfd)
 {
   struct xwii_event event;
-  int ret = 0, fds_num;
-  struct pollfd fds[2];
+  unsigned int num = 0;
+  uint64_t dispatched;
+  int ret;
+
+  while (dev->iface) {
+    ret = xwii_iface_dispatch(dev->iface, &event, sizeof(event));
+    if (ret == -EAGAIN)
+      break;
+
+    if (ret) {
+      print_error("Error: Read failed with err:%d", ret);
+    } else {
+      ++num;
+      dispatched = latency_now();
+      latency_dispatched(&event);
+      record_event(dev, &event);
+      if (event.type == XWII_EVENT_WATCH)
+        wiimote_reopen(dev);
+      if (event.type != XWII_EVENT_GONE) {
+        if (!freeze)
+          handle_event(dev, &event);
+        latency_processed(event.type, dispatched);
+        continue;
+      }
+      print_info("Info: Device #%u gone", dev->index + 1);
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, xwii_iface_get_fd(dev->iface), NULL);
+    wiimote_close(dev);
+  }
+
+  return num;
+}
+
+/* epoll tags of the output timer and hotplug monitor; remotes use their index */
+#define TAG_TIMER WIIMOTE_MAX
+#define TAG_MONITOR (WIIMOTE_MAX + 1)
+#define TAG_RING (WIIMOTE_MAX + 2)
+#define TAG_CONFIG (WIIMOTE_MAX + 3)
+#define TAG_NUM (WIIMOTE_MAX + 4)
+
+static int epoll_add(int epfd, int fd, uint32_t tag)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 ? -errno : 0;
+}
+
+/*
+ * Pipelined mode: a reader thread drains the remotes into a ring and the
+ * main loop processes the events and writes the virtual devices, so a slow
+ * write() or printf() never delays reading the next report. The reader is
+ * the only thread that touches an attached interface: it dispatches,
+ * reopens and refreshes it, and applies the MotionPlus normalization the
+ * main loop publishes. The main loop closes it once the reader passed on
+ * XWII_EVENT_GONE and let go of it.
+ */
+
+/* epoll tag of the stop eventfd in the reader's set */
+#define TAG_STOP WIIMOTE_MAX
+
+static struct {
+  pthread_t thread;
+  /* remotes read by the reader thread */
+  int epfd;
+  /* reader -> main loop: the ring has entries */
+  int event_fd;
+  /* main loop -> reader: exit */
+  int stop_fd;
+  atomic_bool stop;
+  /* samples dropped on overflow, written by the reader only */
+  uint64_t dropped;
+  struct ring ring;
+} pipeline;
+
+/* reports superseded by the next one; keys and hotplug events are not */
+static bool event_is_sample(unsigned int type)
+{
+  switch (type) {
+  case XWII_EVENT_ACCEL:
+  case XWII_EVENT_IR:
+  case XWII_EVENT_MOTION_PLUS:
+  case XWII_EVENT_NUNCHUK_MOVE:
+  case XWII_EVENT_CLASSIC_CONTROLLER_MOVE:
+  case XWII_EVENT_BALANCE_BOARD:
+  case XWII_EVENT_PRO_CONTROLLER_MOVE:
+  case XWII_EVENT_GUITAR_MOVE:
+  case XWII_EVENT_DRUMS_MOVE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void pipeline_wake(void)
+{
+  uint64_t one = 1;
+
+  if (write(pipeline.event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    print_error("Error: Cannot wake main loop: %d", -errno);
+}
+
+static void pipeline_push(const struct ring_entry *entry)
+{
+  const struct timespec wait = { 0, 1000000 };
+
+  if (ring_push(&pipeline.ring, entry))
+    return;
+
+  if (event_is_sample(entry->event.type)) {
+    pipeline.dropped++;
+    return;
+  }
+
+  /* losing a key release or GONE is worse than stalling the reader */
+  do {
+    pipeline_wake();
+    nanosleep(&wait, NULL);
+  } while (!ring_push(&pipeline.ring, entry) &&
+           !atomic_load(&pipeline.stop));
+}
+
+/* reader side of wiimote_dispatch() */
+static unsigned int reader_drain(struct wiimote *dev)
+{
+  struct ring_entry entry;
+  unsigned int num = 0;
+  int ret;
+
+  entry.dev = dev->index;
+  if (atomic_exchange(&dev->mp_norm_pending, false))
+    mp_refresh(dev);
+  for (;;) {
+    ret = xwii_iface_dispatch(dev->iface, &entry.event, sizeof(entry.event));
+    if (ret == -EAGAIN)
+      break;
+
+    entry.dispatched = latency_now();
+    if (ret) {
+      print_error("Error: Read failed with err:%d", ret);
+      memset(&entry.event, 0, sizeof(entry.event));
+      entry.event.type = XWII_EVENT_GONE;
+    } else {
+      latency_dispatched(&entry.event);
+    }
+
+    if (entry.event.type == XWII_EVENT_WATCH)
+      wiimote_reopen(dev);
+    if (entry.event.type == XWII_EVENT_GONE)
+      epoll_ctl(pipeline.epfd, EPOLL_CTL_DEL, xwii_iface_get_fd(dev->iface),
+                NULL);
+
+    pipeline_push(&entry);
+    ++num;
+    if (entry.event.type == XWII_EVENT_GONE)
+      break;
+  }
+
+  return num;
+}
+
+static void *reader_main(void *arg)
+{
+  struct epoll_event ev[WIIMOTE_MAX + 1];
+  unsigned int num;
+  int i, n;
+
+  while (!atomic_load(&pipeline.stop)) {
+    n = epoll_wait(pipeline.epfd, ev, WIIMOTE_MAX + 1, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      print_error("Error: Reader cannot poll fds: %d", -errno);
+      quit = 1;
+      break;
+    }
+
+    num = 0;
+    for (i = 0; i < n; i++) {
+      if (ev[i].data.u32 < WIIMOTE_MAX)
+        num += reader_drain(&wiimotes[ev[i].data.u32]);
+    }
+    if (num)
+      pipeline_wake();
+  }
+
+  return NULL;
+}
+
+/* main loop side: process everything the reader queued up */
+static unsigned int pipeline_drain(void)
+{
+  struct ring_entry entry;
+  struct wiimote *dev;
+  unsigned int num = 0;
+  uint64_t count;
+
+  if (read(pipeline.event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    print_error("Error: Cannot read ring eventfd: %d", -errno);
+
+  while (ring_pop(&pipeline.ring, &entry)) {
+    ++num;
+    dev = &wiimotes[entry.dev];
+    record_event(dev, &entry.event);
+    if (entry.event.type == XWII_EVENT_GONE) {
+      print_info("Info: Device #%u gone", dev->index + 1);
+      wiimote_close(dev);
+    } else {
+      if (!freeze)
+        handle_event(dev, &entry.event);
+      latency_processed(entry.event.type, entry.dispatched);
+    }
+  }
+
+  return num;
+}
+
+static int pipeline_start(void)
+{
+  sigset_t mask, old;
+  int ret;
 
-  memset(fds, 0, sizeof(fds));
-  fds[0].fd = 0;
-  fds[0].events = POLLIN;
-  fds[1].fd = xwii_iface_get_fd(iface);
-  fds[1].events = POLLIN;
-  fds_num = 2;
+  ring_init(&pipeline.ring);
+  atomic_init(&pipeline.stop, false);
+  pipeline.epfd = epoll_create1(EPOLL_CLOEXEC);
+  pipeline.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  pipeline.stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (pipeline.epfd < 0 || pipeline.event_fd < 0 || pipeline.stop_fd < 0) {
+    ret = -errno;
+    goto err;
+  }
 
-  ret = xwii_iface_watch(iface, true);
+  ret = epoll_add(pipeline.epfd, pipeline.stop_fd, TAG_STOP);
   if (ret)
-    print_error("Error: Cannot initialize hotplug watch descriptor");
+    goto err;
+
+  /* signals are left to the main loop */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  ret = -pthread_create(&pipeline.thread, NULL, reader_main, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (!ret)
+    return 0;
+
+err:
+  if (pipeline.epfd >= 0)
+    close(pipeline.epfd);
+  if (pipeline.event_fd >= 0)
+    close(pipeline.event_fd);
+  if (pipeline.stop_fd >= 0)
+    close(pipeline.stop_fd);
+  return ret;
+}
+
+static void pipeline_stop(void)
+{
+  uint64_t one = 1;
+
+  atomic_store(&pipeline.stop, true);
+  if (write(pipeline.stop_fd, &one, sizeof(one)) < 0)
+    print_error("Error: Cannot stop reader: %d", -errno);
+  pthread_join(pipeline.thread, NULL);
+
+  print_info("Info: ring: %" PRIu64 " events, %" PRIu64 " overflows, %" PRIu64
+             " samples dropped, high water %u/%u",
+             atomic_load(&pipeline.ring.pushed),
+             atomic_load(&pipeline.ring.overflows), pipeline.dropped,
+             atomic_load(&pipeline.ring.high_water), RING_SIZE);
+
+  close(pipeline.epfd);
+  close(pipeline.event_fd);
+  close(pipeline.stop_fd);
+}
 
-  while (true) {
-    ret = poll(fds, fds_num, -1);
-    if (ret < 0) {
+/* hotplug */
+
+/*
+ * Pick the slot for a newly appeared remote: a detached slot of the same
+ * remote keeps its calibration, filters and virtual devices, otherwise a
+ * fresh slot or any detached one is used. NULL if the path is already
+ * attached or all slots are busy.
+ */
+static struct wiimote *wiimote_slot(const char *path, const char *id)
+{
+  struct wiimote *dev, *spare = NULL;
+  unsigned int i;
+
+  for (i = 0; i < wiimote_num; i++) {
+    dev = &wiimotes[i];
+    if (dev->iface) {
+      if (!strcmp(xwii_iface_get_syspath(dev->iface), path))
+        return NULL;
+    } else if (id[0] && !strcmp(dev->id, id)) {
+      return dev;
+    } else if (!spare) {
+      spare = dev;
+    }
+  }
+
+  if (wiimote_num < WIIMOTE_MAX) {
+    dev = &wiimotes[wiimote_num];
+    wiimote_init(dev, wiimote_num++, NULL);
+    return dev;
+  }
+
+  /* another remote takes over the slot; drop the old tracking state */
+  if (spare) {
+    wiimote_set_mode(spare, mode);
+    memset(spare->held, 0, sizeof(spare->held));
+    ir_pointer_init(&spare->ir_pointer);
+    gyro_mouse_init(&spare->gyro_mouse);
+    fusion_init(&spare->fusion);
+  }
+  return spare;
+}
+
+static void wiimote_attach(int epfd, const char *path)
+{
+  char id[sizeof(wiimotes[0].id)];
+  struct wiimote *dev;
+
+  if (mp_calib_device_id(path, id, sizeof(id)))
+    id[0] = 0;
+
+  dev = wiimote_slot(path, id);
+  if (!dev) {
+    if (wiimote_num == WIIMOTE_MAX)
+      print_info("Info: Ignoring %s, all %d slots in use", path, WIIMOTE_MAX);
+    return;
+  }
+
+  if (wiimote_open(dev, path))
+    return;
+
+  if (epoll_add(epfd, xwii_iface_get_fd(dev->iface), dev->index)) {
+    print_error("Error: Cannot watch device #%u", dev->index + 1);
+    wiimote_close(dev);
+    return;
+  }
+
+  print_info("Info: Device #%u attached: %s", dev->index + 1, path);
+}
+
+/* attach everything the monitor reported since the last call */
+static void monitor_dispatch(struct xwii_monitor *mon, int epfd)
+{
+  char *ent;
+
+  while ((ent = xwii_monitor_poll(mon))) {
+    if (epfd >= 0)
+      wiimote_attach(epfd, ent);
+    free(ent);
+  }
+}
+
+static int run_iface(void)
+{
+  struct epoll_event ev[TAG_NUM];
+  struct xwii_monitor *mon;
+  int ret = 0, epfd, remote_epfd, timer_fd, config_fd, i, n;
+  unsigned int j;
+  uint64_t expirations;
+  bool motion;
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    ret = -errno;
+    print_error("Error: Cannot create epoll fd: %d", ret);
+    return ret;
+  }
+
+  timer_fd = output_timer_new(output_rate);
+  if (timer_fd >= 0)
+    epoll_add(epfd, timer_fd, TAG_TIMER);
+
+  /* in pipelined mode the remotes go to the reader thread instead */
+  remote_epfd = epfd;
+  if (pipelined) {
+    ret = pipeline_start();
+    if (ret) {
+      print_error("Error: Cannot start reader thread: %d", ret);
+      pipelined = false;
+      ret = 0;
+    } else {
+      remote_epfd = pipeline.epfd;
+      epoll_add(epfd, pipeline.event_fd, TAG_RING);
+    }
+  }
+
+  for (j = 0; j < wiimote_num; j++) {
+    if (wiimotes[j].iface &&
+        epoll_add(remote_epfd, xwii_iface_get_fd(wiimotes[j].iface), j))
+      print_error("Error: Cannot watch device #%u", j + 1);
+  }
+
+  /*
+   * Keep a hotplug monitor in the set so remotes paired or reconnected
+   * later are attached without a restart. The initial enumeration only
+   * lists what is attached already and is skipped.
+   */
+  mon = xwii_monitor_new(true, false);
+  if (!mon) {
+    print_error("Error: Cannot create hotplug monitor");
+  } else {
+    monitor_dispatch(mon, -1);
+    if (epoll_add(epfd, xwii_monitor_get_fd(mon, false), TAG_MONITOR))
+      print_error("Error: Cannot watch hotplug monitor");
+  }
+
+  /* config changes are parsed by a thread of their own, see config.c */
+  config_fd = config_watch_start();
+  if (config_fd >= 0 && epoll_add(epfd, config_fd, TAG_CONFIG))
+    print_error("Error: Cannot watch config");
+
+  while (!quit) {
+    check_dump();
+    config_leave();
+    n = epoll_wait(epfd, ev, TAG_NUM, -1);
+    config = config_enter();
+    if (n < 0) {
       if (errno != EINTR) {
         ret = -errno;
         print_error("Error: Cannot poll fds: %d", ret);
         break;
       }
+      continue;
     }
 
-    ret = xwii_iface_dispatch(iface, &event, sizeof(event));
-    if (ret) {
-      if (ret != -EAGAIN) {
-        print_error("Error: Read failed with err:%d",
-              ret);
-        break;
+    /*
+     * Motion is coalesced until the output timer fires, or sent right away
+     * if no output rate is set.
+     */
+    motion = timer_fd < 0;
+    for (i = 0; i < n; i++) {
+      if (ev[i].data.u32 == TAG_TIMER) {
+        if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+          motion = true;
+        continue;
       }
-    } else if (!freeze) {
-      //printf("event.type: %d\n", event.type);
-      switch (event.type) {
-      case XWII_EVENT_GONE:
-        print_info("Info: Device gone");
-        fds[1].fd = -1;
-        fds[1].events = 0;
-        fds_num = 1;
-        break;
-      case XWII_EVENT_WATCH:
-        handle_watch();
-        break;
-      case XWII_EVENT_KEY:
-        if (mode != MODE_ERROR) {
-        printf("event key\n");
-          key_show(&event);
-        }
-        break;
-      case XWII_EVENT_ACCEL:
-        if (mode == MODE_EXTENDED)
-          accel_show_ext(&event);
-        if (mode != MODE_ERROR)
-          accel_show(&event);
-        break;
-      case XWII_EVENT_IR:
-        if (mode == MODE_EXTENDED)
-          ir_show_ext(&event);
-        if (mode != MODE_ERROR)
-          ir_show(&event);
-        break;
-      case XWII_EVENT_MOTION_PLUS:
-        if (mode != MODE_ERROR)
-          mp_show(&event);
-        break;
-      case XWII_EVENT_NUNCHUK_KEY:
-      case XWII_EVENT_NUNCHUK_MOVE:
-        if (mode == MODE_EXTENDED)
-          nunchuk_show_ext(&event);
-        break;
-      case XWII_EVENT_CLASSIC_CONTROLLER_KEY:
-      case XWII_EVENT_CLASSIC_CONTROLLER_MOVE:
-        if (mode == MODE_EXTENDED)
-          classic_show_ext(&event);
-        break;
-      case XWII_EVENT_BALANCE_BOARD:
-        if (mode == MODE_EXTENDED)
-          bboard_show_ext(&event);
-        break;
-      case XWII_EVENT_PRO_CONTROLLER_KEY:
-      case XWII_EVENT_PRO_CONTROLLER_MOVE:
-        if (mode == MODE_EXTENDED)
-          pro_show_ext(&event);
-        break;
-      case XWII_EVENT_GUITAR_KEY:
-      case XWII_EVENT_GUITAR_MOVE:
-        if (mode == MODE_EXTENDED)
-          guit_show_ext(&event);
-        break;
-      case XWII_EVENT_DRUMS_KEY:
-      case XWII_EVENT_DRUMS_MOVE:
-        if (mode == MODE_EXTENDED)
-          drums_show_ext(&event);
-        break;
+      if (ev[i].data.u32 == TAG_MONITOR) {
+        monitor_dispatch(mon, remote_epfd);
+        continue;
+      }
+      if (ev[i].data.u32 == TAG_RING) {
+        burst_account(pipeline_drain());
+        continue;
       }
+      if (ev[i].data.u32 == TAG_CONFIG) {
+        config_watch_dispatch();
+        continue;
+      }
+      burst_account(wiimote_dispatch(&wiimotes[ev[i].data.u32], epfd));
     }
 
+    for (j = 0; j < wiimote_num; j++)
+      wiimote_flush(&wiimotes[j], motion);
+    latency_written();
+
 #if 0
     ret = keyboard();
     if (ret == -ECANCELED)
@@ -1287,9 +2448,125 @@ static int run_iface(struct xwii_iface *iface)
 #endif
   }
 
+  if (pipelined)
+    pipeline_stop();
+  config_watch_stop();
+  if (mon)
+    xwii_monitor_unref(mon);
+  if (timer_fd >= 0)
+    close(timer_fd);
+  close(epfd);
+  burst_print();
+  latency_dump();
   return ret;
 }
 
+/* replay */
+
+/* slots are created up to the highest remote index seen in the trace */
+static struct wiimote *replay_slot(unsigned int index, const char *fallback)
+{
+  if (index >= WIIMOTE_MAX)
+    return NULL;
+
+  while (wiimote_num <= index) {
+    wiimote_init(&wiimotes[wiimote_num], wiimote_num,
+                 wiimote_num ? NULL : fallback);
+    mp_calib_init(&wiimotes[wiimote_num].mp_calib);
+    wiimote_num++;
+  }
+  return &wiimotes[index];
+}
+
+static void timespec_add(struct timespec *ts, double sec)
+{
+  long nsec = (long)((sec - (long)sec) * 1e9);
+
+  ts->tv_sec += (long)sec;
+  ts->tv_nsec += nsec;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+/*
+ * Feed a recorded trace through the same handlers and output path as live
+ * remotes. Events with the same timestamp arrived in one report and are
+ * handled as one wakeup. Real-time pacing sleeps until each report is due,
+ * -F replays as fast as possible; -r is applied in trace time.
+ */
+static int run_replay(const char *path, const char *fallback)
+{
+  const struct trace_record *rec, *end;
+  struct timespec start, due, now;
+  struct trace trace;
+  struct wiimote *dev;
+  double t, t0 = 0, last_motion = 0, elapsed;
+  uint64_t dispatched;
+  unsigned int j, num;
+  bool motion;
+  int ret;
+
+  ret = trace_map(&trace, path);
+  if (ret) {
+    print_error("Error: Cannot map trace %s: %d", path, ret);
+    return ret;
+  }
+  print_info("Info: Replaying %zu events from %s", trace.num, path);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (trace.num)
+    t0 = last_motion = event_time(&trace.records[0].event);
+
+  rec = trace.records;
+  end = rec + trace.num;
+  while (rec < end && !quit) {
+    check_dump();
+    t = event_time(&rec->event);
+    if (!replay_fast && t > t0) {
+      due = start;
+      timespec_add(&due, t - t0);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+    }
+
+    for (num = 0; rec < end && event_time(&rec->event) == t; rec++) {
+      dev = replay_slot(rec->dev, fallback);
+      if (!dev)
+        continue;
+      ++num;
+      dispatched = latency_now();
+      record_event(dev, &rec->event);
+      /* hotplug events refer to the recorded interface, not ours */
+      if (rec->event.type == XWII_EVENT_WATCH ||
+          rec->event.type == XWII_EVENT_GONE)
+        continue;
+      if (!freeze)
+        handle_event(dev, &rec->event);
+      latency_processed(rec->event.type, dispatched);
+    }
+    burst_account(num);
+
+    motion = !output_rate || t - last_motion >= 1.0 / output_rate;
+    if (motion)
+      last_motion = t;
+    for (j = 0; j < wiimote_num; j++)
+      wiimote_flush(&wiimotes[j], motion);
+    latency_written();
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec) / 1e9;
+  print_info("Info: Replayed %zu events in %.6f s (%.0f events/s)",
+             (size_t)(rec - trace.records), elapsed,
+             elapsed > 0 ? (rec - trace.records) / elapsed : 0.0);
+
+  trace_unmap(&trace);
+  burst_print();
+  latency_dump();
+  return 0;
+}
+
 static int enumerate(void)
 {
   struct xwii_monitor *mon;
@@ -1337,18 +2614,198 @@ static char *get_dev(int num)
   return ent;
 }
 
+/* resolve "all", "<num>" or a sysfs path into device paths */
+static unsigned int get_devs(const char *spec, char **paths, unsigned int max)
+{
+  struct xwii_monitor *mon;
+  char *ent;
+  unsigned int num = 0;
+
+  if (strcmp(spec, "all")) {
+    paths[0] = spec[0] == '/' ? strdup(spec) : get_dev(atoi(spec));
+    return paths[0] ? 1 : 0;
+  }
+
+  mon = xwii_monitor_new(false, false);
+  if (!mon) {
+    printf("Cannot create monitor\n");
+    return 0;
+  }
+
+  while ((ent = xwii_monitor_poll(mon))) {
+    if (num < max)
+      paths[num++] = ent;
+    else
+      free(ent);
+  }
+
+  xwii_monitor_unref(mon);
+  return num;
+}
+
+/* -r: output rate in Hz, 1 to OUTPUT_RATE_MAX */
+static int parse_output_rate(const char *arg)
+{
+  unsigned long rate;
+  char *end;
+
+  errno = 0;
+  rate = strtoul(arg, &end, 10);
+  if (errno || *end || end == arg || *arg == '-' || rate < 1 ||
+      rate > OUTPUT_RATE_MAX)
+    return -EINVAL;
+  output_rate = rate;
+  return 0;
+}
+
+/* -a: "[mode=]profile", without a mode for all of them */
+static int parse_pointer_accel(const char *arg)
+{
+  struct mouse_accel_params params;
+  const char *eq = strchr(arg, '=');
+  const char *colon = strchr(arg, ':');
+  unsigned int m, first = 0, last = MODE_NUM - 1;
+
+  if (eq && (!colon || eq < colon)) {
+    for (m = 0; m < MODE_NUM; m++)
+      if (mode_names[m] && strlen(mode_names[m]) == (size_t)(eq - arg) &&
+          !strncmp(arg, mode_names[m], eq - arg))
+        break;
+    if (m == MODE_NUM)
+      return -EINVAL;
+    first = last = m;
+    arg = eq + 1;
+  }
+
+  if (mouse_accel_parse(&params, arg))
+    return -EINVAL;
+  for (m = first; m <= last; m++)
+    pointer_accel_params[m] = params;
+  /* plain mode also covers the extension-driven tilt pointer */
+  if (first == MODE_NORMAL && last == MODE_NORMAL)
+    pointer_accel_params[MODE_EXTENDED] = params;
+  return 0;
+}
+
 static void free_mouse(void)
 {
-  mouse_close(mouse_fd);
+  unsigned int i;
+
+  for (i = 0; i < wiimote_num; i++)
+    wiimote_free(&wiimotes[i]);
 }
 
 int main(int argc, char **argv)
 {
-  int ret = 0;
-  char *path = NULL;
+  int ret = 0, argn = 2, opt, filter, n;
+  unsigned int i, num = 0;
+  char *paths[WIIMOTE_MAX], *tok;
+  const char *fallback = NULL, *record_path = NULL, *prog = argv[0];
+  const char *config_path = NULL;
+  static struct config base;
+  unsigned int line;
+  FILE *file;
+  bool help = false;
+
+  while ((opt = getopt(argc, argv, "+hpvFr:f:a:C:R:P:")) != -1) {
+    switch (opt) {
+    case 'p':
+      pipelined = true;
+      break;
+    case 'v':
+      log_level++;
+      break;
+    case 'a':
+      if (parse_pointer_accel(optarg))
+        help = true;
+      break;
+    case 'C':
+      config_path = optarg;
+      break;
+    case 'R':
+      record_path = optarg;
+      break;
+    case 'P':
+      replay_path = optarg;
+      break;
+    case 'F':
+      replay_fast = true;
+      break;
+    case 'r':
+      if (parse_output_rate(optarg))
+        help = true;
+      break;
+    case 'f':
+      filter = filter_parse_type(optarg);
+      if (filter < 0)
+        help = true;
+      for (n = 0; filter >= 0 && n < MODE_NUM; n++)
+        filter_params[n].type = filter;
+      break;
+    default:
+      help = true;
+      break;
+    }
+  }
+  /* shift positional arguments so they start at argv[1] again */
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  ext_curve_params.scale = 10;
+  curve_build(&ext_curve_x, &ext_curve_params, -EXT_CURVE_RANGE,
+              EXT_CURVE_RANGE, 0, false);
+  ext_curve_params.scale = 5;
+  curve_build(&ext_curve_yz, &ext_curve_params, -EXT_CURVE_RANGE,
+              EXT_CURVE_RANGE, 0, false);
+
+  /* the defaults and options are what every config (re)load starts from */
+  bind_init(&base.bindings);
+  base.steer_range = STEER_RANGE;
+  base.steer_dead_zone = STEER_DEAD_ZONE;
+  base.steer_params.type = CURVE_POWER;
+  base.steer_params.exponent = 1.0f;
+  base.stick_dead_zone[0] = base.stick_dead_zone[1] = STICK_DEAD_ZONE;
+  base.stick_params.type = CURVE_POWER;
+  base.stick_params.exponent = STICK_EXPONENT;
+  base.stick_speed = STICK_SPEED;
+  base.scroll_speed = SCROLL_SPEED;
+  base.wasd_threshold = WASD_THRESHOLD;
+  file = fmemopen((void *)default_bindings, strlen(default_bindings), "r");
+  if (!file || config_load(&base, file, mode_names, MODE_NUM, &line)) {
+    fprintf(stderr, "Cannot load default key bindings\n");
+    exit(EXIT_FAILURE);
+  }
+  fclose(file);
+  memcpy(base.filter, filter_params, sizeof(filter_params));
+  memcpy(base.accel_params, pointer_accel_params, sizeof(pointer_accel_params));
+  base.gyro = gyro_params;
+  ret = config_init(&base, config_path, mode_names, MODE_NUM, &line);
+  if (ret) {
+    fprintf(stderr, "Cannot load config %s, line %u: %s\n",
+            config_path, line, strerror(-ret));
+    exit(EXIT_FAILURE);
+  }
+  /* held by the main thread except while it waits for input */
+  config = config_enter();
+
+  /* a replayed trace takes the place of the device list */
+  if (replay_path)
+    argn = 1;
 
-  if (argc < 2 || !strcmp(argv[1], "-h")) {
+  if ((argc < 2 && !replay_path) || help) {
     printf("Usage:\n");
+    printf("\t%s [-v] [-p] [-r hz] [-f filter] [-a [mode=]accel] [-C config] [-R trace] <wii_device>[,<wii_device>...] [fallback_input_device] [mode]\n", prog);
+    printf("\t%s [-v] [-r hz] [-f filter] [-a [mode=]accel] [-C config] -P trace [-F] [fallback_input_device] [mode]\n", prog);
+    printf("\twii_device: device number, sysfs path or \"all\" (up to %d remotes)\n", WIIMOTE_MAX);
+    printf("\t-v: More messages, -v for key events, -vv for per-event output\n");
+    printf("\t-p: Read remotes on a separate thread, decoupled from output\n");
+    printf("\t-r hz: Send pointer motion at most hz times a second, 1-%d (default: as fast as possible)\n", OUTPUT_RATE_MAX);
+    printf("\t-f filter: Pointer smoothing: none, euro (default) or kalman\n");
+    printf("\t-a [mode=]accel: Pointer ballistics for one mode (normal, gyro) or all: flat:<gain> (default flat:1), adaptive:<max_gain>[,<threshold>[,<max_speed>]] or custom:<speed>=<gain>,...\n");
+    printf("\t-C config: Key bindings and tuning file, reloaded when it changes\n");
+    printf("\t-R trace: Append all remote events to a trace file\n");
+    printf("\t-P trace: Replay a trace in real time instead of reading remotes, -F as fast as possible\n");
+    printf("\tmode: nfs (steering wheel gamepad, 1/2 brake/gas), ir (point with the IR camera at a sensor bar), gyro (MotionPlus air mouse, hold B to re-aim)\n");
     printf("\txwiishow [-h]: Show help\n");
     printf("\txwiishow list: List connected devices\n");
     printf("\txwiishow <num>: Show device with number #num\n");
@@ -1372,45 +2829,90 @@ int main(int argc, char **argv)
     printf("\t3: Toggle LED 3\n");
     printf("\t4: Toggle LED 4\n");
     ret = -1;
-  } else if (!strcmp(argv[1], "list")) {
+  } else if (!replay_path && !strcmp(argv[1], "list")) {
     printf("Listing connected Wii Remote devices:\n");
     ret = enumerate();
     printf("End of device list\n");
   } else {
-    if(argc<3) {
-      fprintf(stderr, "Usage: [sudo] %s <wii_device> <mouse_input_device> [mode]\nExample: sudo %s 1 /dev/input/event6\n         sudo %s 1 /dev/input/event6 nfs\n", argv[0], argv[0], argv[0]);
-      exit(EXIT_FAILURE);
+    /* optional fallback event node, used only if uinput is unavailable */
+    if (argc > argn && argv[argn][0] == '/')
+      fallback = argv[argn++];
+
+    if (argc > argn) {
+      if (!strcmp(argv[argn], "nfs")) {
+        mode = MODE_NFS;
+      } else if (!strcmp(argv[argn], "ir")) {
+        mode = MODE_IR;
+      } else if (!strcmp(argv[argn], "gyro")) {
+        mode = MODE_GYRO;
+      } else {
+        fprintf(stderr, "Usage: [sudo] %s [-r hz] <wii_device> [fallback_input_device] [mode]\nExample: sudo %s 1\n         sudo %s -r 120 1 nfs\n         sudo %s 1,2 ir\n         sudo %s 1 /dev/input/event6 nfs\n", prog, prog, prog, prog, prog);
+        exit(EXIT_FAILURE);
+      }
     }
-   
-    if(argc==4) {
-      if(!strcmp(argv[3], "nfs")) mode = MODE_NFS;
+
+    /* registered first so it runs last and still writes the exit messages */
+    if (!log_start(stdout))
+      atexit(log_stop);
+
+    if (record_path) {
+      ret = trace_create(&recorder, record_path);
+      if (ret) {
+        printf("Cannot record to '%s': %s\n", record_path, strerror(-ret));
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    if (replay_path) {
+      atexit(free_mouse);
+      signal(SIGINT, handle_signal);
+      signal(SIGTERM, handle_signal);
+      signal(SIGUSR1, handle_signal);
+      ret = run_replay(replay_path, fallback);
+      goto out;
+    }
+
+    /* remotes: comma separated numbers/paths or "all" */
+    for (tok = strtok(argv[1], ","); tok && num < WIIMOTE_MAX;
+         tok = strtok(NULL, ","))
+      num += get_devs(tok, &paths[num], WIIMOTE_MAX - num);
+    /* "all" may start empty and wait for remotes to be paired */
+    if (!num && strcmp(argv[1], "all")) {
+      printf("Cannot find device '%s'\n", argv[1]);
+      exit(EXIT_FAILURE);
     }
 
-    mouse_fd = mouse_init(argv[2]);
     atexit(free_mouse);
-    if (argv[1][0] != '/')
-      path = get_dev(atoi(argv[1]));
-      
-    ret = xwii_iface_new(&iface, path ? path : argv[1]);
-    free(path);
-    if (ret) {
-      printf("Cannot create xwii_iface '%s' err:%d\n",
-                argv[1], ret);
-    } else {
+    for (i = 0; i < num; i++) {
+      /* the fallback node can only serve one remote */
+      wiimote_init(&wiimotes[wiimote_num], wiimote_num, i ? NULL : fallback);
+      if (!wiimote_open(&wiimotes[wiimote_num], paths[i]))
+        print_info("Info: Device #%u: %s", ++wiimote_num, paths[i]);
+      else
+        wiimote_free(&wiimotes[wiimote_num]);
+      free(paths[i]);
+    }
 
-      ret = xwii_iface_open(iface,
-                xwii_iface_available(iface) |
-                XWII_IFACE_WRITABLE);
-      if (ret)
-        print_error("Error: Cannot open interface: %d",
-              ret);
+    if (!wiimote_num && num) {
+      ret = -ENODEV;
+    } else {
+      signal(SIGINT, handle_signal);
+      signal(SIGTERM, handle_signal);
+      signal(SIGUSR1, handle_signal);
 
-      ret = run_iface(iface);
-      xwii_iface_unref(iface);
+      ret = run_iface();
       if (ret) {
         print_error("Program failed; press any key to exit");
       }
     }
+
+out:
+    if (recorder.file) {
+      print_info("Info: Trace %s holds %" PRIu64 " events", record_path,
+                 recorder.num);
+      if (trace_close(&recorder))
+        print_error("Error: Cannot finish trace %s", record_path);
+    }
   }
 
   return abs(ret);